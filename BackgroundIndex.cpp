@@ -0,0 +1,235 @@
+//C
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+//C++
+#include <iostream>
+#include <map>
+
+#include "BackgroundIndex.h"
+#include "gmmstd_mapped_file.h"
+#include "dirent.h"
+
+// SSE2 (sempre presente su x64) per il confronto delle firme
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#include <emmintrin.h>
+#define BGINDEX_SSE2
+#endif
+
+#define BGINDEX_MAGIC "BGIX"
+#define BGINDEX_VERSION 1
+
+using namespace std;
+using namespace cv;
+
+static const size_t SIGNATURE_SIZE = BackgroundIndex::THUMB_WIDTH * BackgroundIndex::THUMB_HEIGHT * 3;
+
+// somma delle differenze assolute tra due firme (a 64 bit: non puo' traboccare)
+static unsigned long long signatureDistance(const uchar* a, const uchar* b, size_t n){
+	unsigned long long score = 0;
+	size_t i = 0;
+#ifdef BGINDEX_SSE2
+	__m128i acc = _mm_setzero_si128();
+	for(; i+16<=n; i+=16)
+		acc = _mm_add_epi64(acc, _mm_sad_epu8(_mm_loadu_si128((const __m128i*)(a + i)), _mm_loadu_si128((const __m128i*)(b + i))));
+	unsigned long long lanes[2];
+	_mm_storeu_si128((__m128i*)lanes, acc);
+	score = lanes[0] + lanes[1];
+#endif
+	for(; i<n; ++i)
+		score += abs((int)a[i] - (int)b[i]);
+	return score;
+}
+
+BackgroundIndex::BackgroundIndex() : decoded(0) {}
+
+void BackgroundIndex::makeSignature(const Mat& frame, Mat& signature){
+	// INTER_AREA: ogni pixel della miniatura e' la media della sua zona del frame
+	resize(frame, signature, Size(THUMB_WIDTH, THUMB_HEIGHT), 0, 0, INTER_AREA);
+}
+
+bool BackgroundIndex::loadFromDirectory(const string& dirPath, const string& cacheFile){
+
+	DIR* dir;
+	dir = opendir(dirPath.c_str());
+	if(!dir)
+		return false;
+
+	path = dirPath;
+	entries.clear();
+	signatures.clear();
+	decoded = 0;
+	unreadableNames.clear();
+
+	//Carico il vettore con i nomi dei file presenti nella cartella backgrounds
+	dirent* file;
+	while((file = readdir(dir))){
+		string tmp = file->d_name;
+		if( (tmp.compare(".") != 0) && (tmp.compare("..") != 0) && (tmp.compare("Thumbs.db") != 0)){
+			Entry e;
+			e.name = tmp;
+			struct stat st;
+			if(stat((path + tmp).c_str(), &st) == 0){
+				e.fileSize = st.st_size;
+				e.modified = st.st_mtime;
+			}
+			else {
+				e.fileSize = -1;
+				e.modified = -1;
+			}
+			entries.push_back(e);
+		}
+	}
+	closedir(dir);
+
+	//Firme gia' calcolate (se la cache c'e' ed e' della stessa versione)
+	vector<Entry> cachedEntries;
+	vector<uchar> cachedSignatures;
+	map<string, size_t> cached;
+	if(readCache(cacheFile, cachedEntries, cachedSignatures))
+		for(size_t i=0; i<cachedEntries.size(); ++i)
+			cached[cachedEntries[i].name] = i;
+
+	//Restano in entries solo i background di cui si ha la firma
+	vector<Entry> found;
+	found.swap(entries);
+	signatures.reserve(found.size() * SIGNATURE_SIZE);
+	for(size_t i=0; i<found.size(); ++i){
+		const Entry& e = found[i];
+
+		map<string, size_t>::const_iterator it = cached.find(e.name);
+		if(it != cached.end() && e.fileSize >= 0 &&
+			cachedEntries[it->second].fileSize == e.fileSize && cachedEntries[it->second].modified == e.modified){
+			const uchar* sig = &cachedSignatures[it->second * SIGNATURE_SIZE];
+			signatures.insert(signatures.end(), sig, sig + SIGNATURE_SIZE);
+			entries.push_back(e);
+			continue;
+		}
+
+		//Apro il video di background e carico il primo fotogramma
+		VideoCapture vid_bg(path + e.name);
+		Mat3b frame_bg;
+		if(!vid_bg.isOpened() || !vid_bg.read(frame_bg)){
+			//Un background rovinato non deve fermare gli altri video: lo scarto e lo segnalo
+			cout << "Impossibile aprire il video di background (scartato): " << path + e.name << endl;
+			unreadableNames.push_back(e.name);
+			continue;
+		}
+		Mat signature;
+		makeSignature(frame_bg, signature);
+		const uchar* sig = signature.ptr<uchar>(0);
+		signatures.insert(signatures.end(), sig, sig + SIGNATURE_SIZE);
+		entries.push_back(e);
+		++decoded;
+	}
+
+	// la cache va riscritta se qualcosa e' cambiato (anche solo dei file rimossi)
+	if(decoded > 0 || cachedEntries.size() != entries.size())
+		if(!writeCache(cacheFile))
+			cout << "Impossibile scrivere la cache dei background: " << cacheFile << endl;
+
+	return true;
+}
+
+bool BackgroundIndex::readCache(const string& cacheFile, vector<Entry>& cachedEntries, vector<uchar>& cachedSignatures) const {
+
+	FILE* f = fopen(cacheFile.c_str(), "rb");
+	if(!f)
+		return false;
+
+	// intestazione: magic, versione, dimensioni della miniatura, numero di firme
+	char magic[4];
+	unsigned int header[4];
+	bool ok = fread(magic, 1, 4, f) == 4 && memcmp(magic, BGINDEX_MAGIC, 4) == 0 &&
+		fread(header, sizeof(unsigned int), 4, f) == 4 &&
+		header[0] == BGINDEX_VERSION && header[1] == THUMB_WIDTH && header[2] == THUMB_HEIGHT;
+
+	if(ok){
+		cachedEntries.resize(header[3]);
+		cachedSignatures.resize(header[3] * SIGNATURE_SIZE);
+		for(size_t i=0; ok && i<cachedEntries.size(); ++i){
+			Entry& e = cachedEntries[i];
+			unsigned int len = 0;
+			ok = fread(&len, sizeof(len), 1, f) == 1 && len < 4096;
+			if(ok){
+				e.name.resize(len);
+				ok = (len == 0 || fread(&e.name[0], 1, len, f) == len) &&
+					fread(&e.fileSize, sizeof(e.fileSize), 1, f) == 1 &&
+					fread(&e.modified, sizeof(e.modified), 1, f) == 1 &&
+					fread(&cachedSignatures[i * SIGNATURE_SIZE], 1, SIGNATURE_SIZE, f) == SIGNATURE_SIZE;
+			}
+		}
+	}
+	fclose(f);
+
+	if(!ok){
+		cachedEntries.clear();
+		cachedSignatures.clear();
+	}
+	return ok;
+}
+
+bool BackgroundIndex::writeCache(const string& cacheFile) const {
+
+	// scrivo accanto e poi rinomino (come hmm.bank): un'esecuzione interrotta non lascia una cache troncata
+	string tempFile = gmmstd::TempFileName(cacheFile.c_str());
+	FILE* f = fopen(tempFile.c_str(), "wb");
+	if(!f)
+		return false;
+
+	unsigned int header[4] = { BGINDEX_VERSION, THUMB_WIDTH, THUMB_HEIGHT, (unsigned int)entries.size() };
+	bool ok = fwrite(BGINDEX_MAGIC, 1, 4, f) == 4 && fwrite(header, sizeof(unsigned int), 4, f) == 4;
+	for(size_t i=0; ok && i<entries.size(); ++i){
+		const Entry& e = entries[i];
+		unsigned int len = (unsigned int)e.name.size();
+		ok = fwrite(&len, sizeof(len), 1, f) == 1 &&
+			fwrite(e.name.c_str(), 1, len, f) == len &&
+			fwrite(&e.fileSize, sizeof(e.fileSize), 1, f) == 1 &&
+			fwrite(&e.modified, sizeof(e.modified), 1, f) == 1 &&
+			fwrite(&signatures[i * SIGNATURE_SIZE], 1, SIGNATURE_SIZE, f) == SIGNATURE_SIZE;
+	}
+	if(fclose(f) != 0)
+		ok = false;
+	if(!ok){
+		remove(tempFile.c_str());
+		return false;
+	}
+	return gmmstd::ReplaceFileWith(cacheFile.c_str(), tempFile.c_str());
+}
+
+size_t BackgroundIndex::size() const {
+	return entries.size();
+}
+
+size_t BackgroundIndex::decodedCount() const {
+	return decoded;
+}
+
+const vector<string>& BackgroundIndex::unreadable() const {
+	return unreadableNames;
+}
+
+string BackgroundIndex::bestMatch(const Mat3b& frame) const {
+
+	Mat signature;
+	makeSignature(frame, signature);
+	const uchar* sig = signature.ptr<uchar>(0);
+
+	//Cerco a quale background assomiglia di piu'
+	unsigned long long min = ~0ULL;
+	string best;
+
+	for(size_t i=0; i<entries.size(); ++i){
+		unsigned long long score = signatureDistance(sig, &signatures[i * SIGNATURE_SIZE], SIGNATURE_SIZE);
+
+		//Verifico se e' la migliore distanza
+		if(score<min){
+			min = score;
+			best = entries[i].name;
+		}
+	}
+
+	//Costruisco il path corretto
+	return path + best;
+}
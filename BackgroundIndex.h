@@ -0,0 +1,64 @@
+#pragma once
+
+//opencv
+#include <opencv2/opencv.hpp>
+//C++
+#include <string>
+#include <vector>
+#include <memory>
+
+
+// Indice dei video di background (cartella "backgrounds/").
+// Di ogni video si tiene solo una firma: il primo frame ridotto a una miniatura
+// THUMB_WIDTH x THUMB_HEIGHT (BGR, 8 bit). Le firme sono salvate in un file di cache:
+// ai caricamenti successivi i video di background vengono decodificati solo se sono
+// nuovi o cambiati (dimensione o data di modifica diverse).
+// La scelta del background confronta la miniatura del video in input con tutte le firme
+// (somma delle differenze assolute, 16 byte alla volta con SSE2).
+// Dopo il caricamento e' in sola lettura e puo' essere condiviso tra piu' FrameAnalyzer.
+class BackgroundIndex {
+public:
+	static const int THUMB_WIDTH = 64;
+	static const int THUMB_HEIGHT = 48;
+
+	BackgroundIndex();
+
+	// Carica le firme dei video presenti nella cartella (es: "backgrounds/"), usando e
+	// aggiornando cacheFile. Ritorna false se la cartella non si apre.
+	// I video che non si riescono a leggere vengono scartati (vedi unreadable).
+	bool loadFromDirectory(const std::string& path, const std::string& cacheFile = "backgrounds.idx");
+
+	// numero di background caricati
+	std::size_t size() const;
+
+	// quanti background sono stati decodificati dall'ultimo loadFromDirectory (0 se la cache era valida)
+	std::size_t decodedCount() const;
+
+	// video della cartella scartati dall'ultimo loadFromDirectory perche' illeggibili
+	const std::vector<std::string>& unreadable() const;
+
+	// path del background la cui firma e' piu' simile al frame, es: "backgrounds/bg_daria.avi"
+	std::string bestMatch(const cv::Mat3b& frame) const;
+
+	// miniatura (firma) di un frame
+	static void makeSignature(const cv::Mat& frame, cv::Mat& signature);
+
+private:
+	// un video della cartella: nome, dimensione e data di modifica (per validare la cache)
+	struct Entry {
+		std::string name;
+		long long fileSize;
+		long long modified;
+	};
+
+	bool readCache(const std::string& cacheFile, std::vector<Entry>& entries, std::vector<uchar>& signatures) const;
+	bool writeCache(const std::string& cacheFile) const;
+
+	std::string path;
+	std::vector<Entry> entries;
+	std::vector<uchar> signatures; // firme di tutti i background, una dopo l'altra
+	std::size_t decoded;
+	std::vector<std::string> unreadableNames;
+};
+
+typedef std::shared_ptr<BackgroundIndex> BackgroundIndexPtr;
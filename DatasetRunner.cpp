@@ -0,0 +1,130 @@
+//opencv
+#include <opencv2/opencv.hpp>
+//C
+#include <stdlib.h>
+//C++
+#include <iostream>
+#include <iomanip>
+
+#include "DatasetRunner.h"
+#include "FrameAnalyzer.h"
+#include "config.h"
+
+using namespace std;
+using namespace cv;
+
+DatasetRunner::DatasetRunner(unsigned int nThreads) : pool(nThreads) {}
+
+vector<VideoReport> DatasetRunner::run(const vector<string>& datasetLines){
+
+	//Modelli e background caricati una volta per tutti i video
+	cout << "Carico HMM per il testing..." << endl;
+	hmmBank = make_shared<HMMBank>();
+	hmmBank->load(hmmBankFile, "hmm/", &pool);
+
+	backgrounds = make_shared<BackgroundIndex>();
+	if(!backgrounds->loadFromDirectory("backgrounds/")){
+		cout << "Percorso cartella background errato!" << endl;
+		system("pause");
+		exit(EXIT_FAILURE);
+	}
+	cout << "Sono stati caricati " << backgrounds->size() << " background (" << backgrounds->decodedCount() << " decodificati)" << endl;
+	if(!backgrounds->unreadable().empty())
+		cout << "Background illeggibili e scartati: " << backgrounds->unreadable().size() << endl;
+	cout << "Elaboro " << datasetLines.size() << " video su " << pool.size() << " thread" << endl << endl;
+
+	vector<VideoReport> reports(datasetLines.size());
+	// un video per blocco: i thread prendono il video successivo appena finiscono il proprio
+	pool.parallelFor(datasetLines.size(), [&](size_t first, size_t last){
+		for(size_t i=first; i<last; ++i){
+			string category = datasetLines[i].substr(0, datasetLines[i].find("|"));
+			string filePath = datasetLines[i].substr((datasetLines[i].find("|")+1), datasetLines[i].length());
+			reports[i] = processVideo(category, filePath);
+		}
+	}, 1);
+
+	return reports;
+}
+
+VideoReport DatasetRunner::processVideo(const string& category, const string& filePath){
+
+	VideoReport report;
+	report.filename = filePath;
+	report.category = category;
+
+	// FrameAnalyzer tiene il puntatore al nome del file per tutta la sua vita
+	vector<char> filename(filePath.begin(), filePath.end());
+	filename.push_back('\0');
+
+	double t = (double)getTickCount();
+	// un video che si rompe a meta' (es: file corrotto) finisce nel report e non ferma gli altri
+	try {
+		// stadi e modelli girano sul thread del video: il parallelismo e' gia' tra i video
+		// (ThreadPool(1) non crea thread, la pipeline e' inline)
+		FrameAnalyzer frameAnalyzer(&filename[0], category, 0, true, hmmBank, backgrounds, make_shared<ThreadPool>(1), true);
+		if(!frameAnalyzer.isOpened()){
+			report.error = frameAnalyzer.getOpenError();
+			return report;
+		}
+		report.frameCount = frameAnalyzer.getFrameCount();
+
+		while(frameAnalyzer.processFrame())
+			;
+		frameAnalyzer.stop();
+
+		report.correct = frameAnalyzer.getCorrectCount();
+		report.classified = frameAnalyzer.getClassifiedCount();
+		report.bsTime = frameAnalyzer.avgBsTime;
+		report.pdTime = frameAnalyzer.avgPdTime;
+		frameAnalyzer.release();
+	}
+	catch(const exception& e){
+		report.error = e.what();
+		return report;
+	}
+	t = (double)getTickCount() - t;
+	report.seconds = t/getTickFrequency();
+
+	return report;
+}
+
+void DatasetRunner::printReport(const vector<VideoReport>& reports, ostream& out){
+
+	int frames = 0, correct = 0, classified = 0, failed = 0;
+	double bsTime = 0, pdTime = 0, seconds = 0;
+
+	out << "--------------------------------------------------------------------------" << endl;
+	for(size_t i=0; i<reports.size(); ++i){
+		const VideoReport& r = reports[i];
+		if(r.failed()){
+			out << r.category << "\t" << r.filename << "\tERRORE: " << r.error << endl;
+			++failed;
+			continue;
+		}
+		out << r.category << "\t" << r.filename << "\t"
+			<< "SCORE: " << r.correct << "/" << r.classified;
+		if(r.classified > 0)
+			out << ",\t" << ((double)r.correct/(double)r.classified)*100 << " %";
+		out << "\tFPS: " << (r.seconds > 0 ? r.frameCount/r.seconds : 0) << endl;
+
+		frames += r.frameCount;
+		correct += r.correct;
+		classified += r.classified;
+		bsTime += r.bsTime;
+		pdTime += r.pdTime;
+		seconds += r.seconds;
+	}
+	out << "--------------------------------------------------------------------------" << endl;
+
+	out << "Video: " << reports.size() << "\tNon elaborati: " << failed << "\tFrame: " << frames << endl;
+	out << "SCORE TOTALE: " << correct << "/" << classified;
+	if(classified > 0)
+		out << ",\t" << ((double)correct/(double)classified)*100 << " %";
+	out << endl;
+	if(frames > 0){
+		out << "Tempo medio per la Background Subtraction: " << bsTime/frames << endl;
+		out << "Tempo medio per la People Detection: " << pdTime/frames << endl;
+	}
+	// somma dei tempi dei singoli video (con piu' thread e' maggiore del tempo reale)
+	out << "Tempo di elaborazione complessivo (s): " << seconds << endl;
+}
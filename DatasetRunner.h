@@ -0,0 +1,57 @@
+#pragma once
+
+//C++
+#include <string>
+#include <vector>
+#include <ostream>
+
+#include "HMMBank.h"
+#include "BackgroundIndex.h"
+#include "ThreadPool.h"
+
+
+// Risultato dell'elaborazione di un video del dataset
+struct VideoReport {
+	std::string filename;
+	std::string category;
+	int frameCount;
+	int correct; // classificazioni corrette
+	int classified; // classificazioni totali
+	double bsTime; // somma dei tempi di background subtraction (ms)
+	double pdTime; // somma dei tempi di people detection (ms)
+	double seconds; // durata dell'elaborazione del video
+	std::string error; // video non elaborato (es: file non leggibile), vuoto se tutto ok
+
+	VideoReport() : frameCount(0), correct(0), classified(0), bsTime(0), pdTime(0), seconds(0) {}
+
+	bool failed() const { return !error.empty(); }
+};
+
+// Elaborazione di tutto il dataset (modalita' processALL) con piu' video contemporaneamente.
+// Modelli HMM e indice dei background vengono caricati una volta sola e condivisi;
+// ogni video ha il suo FrameAnalyzer (headless), quindi lo stato di MOG, tracking
+// e finestre HMM resta separato. Gli stadi di ogni video girano sul thread del video
+// (un thread per video), e un video che non si apre finisce nel report come errore
+// senza fermare gli altri.
+class DatasetRunner {
+public:
+	// nThreads = video elaborati contemporaneamente (0 = uno per core)
+	explicit DatasetRunner(unsigned int nThreads = 0);
+
+	// datasetLines nel formato di dataset.txt: "categoria|path del video".
+	// I risultati sono nello stesso ordine delle righe.
+	std::vector<VideoReport> run(const std::vector<std::string>& datasetLines);
+
+	// risultati di ogni video e totale (accuratezza e tempi)
+	static void printReport(const std::vector<VideoReport>& reports, std::ostream& out);
+
+private:
+	DatasetRunner(const DatasetRunner&);
+	DatasetRunner& operator=(const DatasetRunner&);
+
+	VideoReport processVideo(const std::string& category, const std::string& filePath);
+
+	ThreadPool pool;
+	HMMBankPtr hmmBank;
+	BackgroundIndexPtr backgrounds;
+};
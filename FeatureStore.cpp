@@ -0,0 +1,330 @@
+//C
+#include <string.h>
+#include <sys/stat.h>
+//C++
+#include <iostream>
+
+#include "FeatureStore.h"
+
+#ifdef _WIN32
+#include <direct.h>
+#endif
+
+using namespace std;
+using namespace featurestore;
+
+// dimensione del buffer di scrittura: qualche centinaio di frame per fwrite
+static const size_t writeBufferSize = 64*1024;
+
+// byte di padding per arrivare a un multiplo di 8
+static size_t padding8(size_t n){
+	return (8 - n%8) % 8;
+}
+
+// posizione nel file (anche oltre i 2GB)
+static bool seekFile(FILE* f, long long pos){
+#ifdef _WIN32
+	return _fseeki64(f, pos, SEEK_SET) == 0;
+#else
+	return fseeko(f, (off_t)pos, SEEK_SET) == 0;
+#endif
+}
+
+// crea la cartella che contiene fileName (e quelle sopra), se mancano
+static void makeParentDirs(const string& fileName){
+	for(size_t i = fileName.find_first_of("/\\"); i != string::npos; i = fileName.find_first_of("/\\", i+1)){
+		if(i == 0)
+			continue;
+		string dir = fileName.substr(0, i);
+#ifdef _WIN32
+		_mkdir(dir.c_str()); // se c'e' gia' fallisce senza fare niente
+#else
+		mkdir(dir.c_str(), 0777);
+#endif
+	}
+}
+
+
+FeatureStoreWriter::FeatureStoreWriter() :
+	file(0), dimension(0), valueSize(0), sequencePos(0), frames(0), used(0), failed(false) {}
+
+FeatureStoreWriter::~FeatureStoreWriter(){
+	close();
+}
+
+bool FeatureStoreWriter::open(const string& fileName, unsigned int dim, bool useFloat,
+	const string& label, const string& sourceVideo){
+
+	close();
+	if(!dim)
+		return false;
+
+	FileHeader header;
+	memcpy(header.magic, fileMagic, sizeof(header.magic));
+	header.version = version;
+	header.endian = endian;
+	header.dimension = dim;
+	header.valueSize = useFloat ? sizeof(float) : sizeof(double);
+	header.labelSize = (unsigned int)label.size();
+	header.sourceSize = (unsigned int)sourceVideo.size();
+
+	// se il file c'e' gia' la nuova sequenza va dopo l'ultimo frame completo; la mappatura
+	// viene chiusa prima di riaprire il file in scrittura
+	long long end = 0;
+	long long lastHeader = -1;
+	unsigned long long lastFrames = 0;
+	{
+		FeatureStoreReader existing;
+		if(existing.open(fileName)){
+			// si aggiungono sequenze solo a un file dello stesso tipo
+			if(existing.dimension() != dim || existing.isFloat() != useFloat ||
+				existing.label() != label || existing.sourceVideo() != sourceVideo){
+				cout << "Feature store " << fileName << " di un altro tipo, non scrivo" << endl;
+				return false;
+			}
+			// versione 1 senza padding: una nuova sequenza allineata non sarebbe piu' ritrovata
+			if(!existing.isPadded() && padding8((size_t)dim*header.valueSize) != 0){
+				cout << "Feature store " << fileName << " in un formato vecchio, non scrivo" << endl;
+				return false;
+			}
+			end = (long long)existing.dataEnd();
+			if(existing.sequences()){
+				lastHeader = (long long)existing.sequenceHeader(existing.sequences()-1);
+				lastFrames = existing.frames(existing.sequences()-1);
+			}
+		}
+	}
+	if(end)
+		file = fopen(fileName.c_str(), "r+b");
+	else{
+		makeParentDirs(fileName);
+		file = fopen(fileName.c_str(), "w+b");
+	}
+	if(!file){
+		cout << "Errore apertura " << fileName << endl;
+		return false;
+	}
+
+	dimension = dim;
+	valueSize = header.valueSize;
+	frames = 0;
+	used = 0;
+	failed = false;
+	buffer.resize(writeBufferSize);
+
+	if(end == 0){
+		// file nuovo: intestazione, etichetta e video, poi padding fino a 8 byte
+		static const char zeros[8] = {0};
+		size_t headerSize = sizeof(header) + label.size() + sourceVideo.size();
+		size_t pad = padding8(headerSize);
+		failed = !seekFile(file, 0) ||
+			fwrite(&header, sizeof(header), 1, file) != 1 ||
+			fwrite(label.data(), 1, label.size(), file) != label.size() ||
+			fwrite(sourceVideo.data(), 1, sourceVideo.size(), file) != sourceVideo.size() ||
+			fwrite(zeros, 1, pad, file) != pad;
+		sequencePos = (long long)(headerSize + pad);
+	}
+	else{
+		// la nuova sequenza inizia a 8 byte: il padding dopo l'ultimo frame viene (ri)scritto
+		// perche' una sequenza non chiusa puo' non averlo
+		static const char zeros[8] = {0};
+		size_t pad = padding8((size_t)end);
+		failed = !seekFile(file, end) || fwrite(zeros, 1, pad, file) != pad;
+		sequencePos = end + (long long)pad;
+		// un'ultima sequenza non chiusa (programma interrotto) ora ha un seguito: le scrivo
+		// il numero di frame, altrimenti il reader la considererebbe lunga fino alla fine del file
+		if(lastHeader >= 0)
+			failed = failed || !seekFile(file, lastHeader + (long long)sizeof(((SequenceHeader*)0)->magic)) ||
+				fwrite(&lastFrames, sizeof(lastFrames), 1, file) != 1;
+	}
+
+	// intestazione della sequenza con 0 frame: il numero viene scritto da close
+	SequenceHeader seq;
+	memcpy(seq.magic, sequenceMagic, sizeof(seq.magic));
+	seq.frames = 0;
+	failed = failed || !seekFile(file, sequencePos) || fwrite(&seq, sizeof(seq), 1, file) != 1;
+	if(failed){
+		cout << "Errore scrittura " << fileName << endl;
+		fclose(file);
+		file = 0;
+		return false;
+	}
+	return true;
+}
+
+bool FeatureStoreWriter::isOpen() const {
+	return file != 0;
+}
+
+bool FeatureStoreWriter::write(const vector<double>& features){
+	if(!file || features.size() != dimension)
+		return false;
+	size_t recordSize = (size_t)dimension*valueSize;
+	if(used + recordSize > buffer.size() && !flush())
+		return false;
+	if(recordSize > buffer.size())
+		buffer.resize(recordSize);
+	char* dst = &buffer[used];
+	if(valueSize == sizeof(float)){
+		float* v = (float*)dst;
+		for(unsigned int i=0; i<dimension; ++i)
+			v[i] = (float)features[i];
+	}
+	else
+		memcpy(dst, &features[0], recordSize);
+	used += recordSize;
+	++frames;
+	return true;
+}
+
+bool FeatureStoreWriter::flush(){
+	if(used && !failed)
+		failed = fwrite(&buffer[0], 1, used, file) != used;
+	used = 0;
+	return !failed;
+}
+
+bool FeatureStoreWriter::close(){
+	if(!file)
+		return true;
+	flush();
+	// padding dopo l'ultimo frame: la sequenza successiva inizia a 8 byte
+	static const char zeros[8] = {0};
+	size_t pad = padding8((size_t)(frames*dimension*valueSize));
+	if(!failed && pad)
+		failed = fwrite(zeros, 1, pad, file) != pad;
+	// la sequenza e' completa: scrivo il numero di frame nella sua intestazione
+	if(!failed && frames)
+		failed = !seekFile(file, sequencePos + (long long)sizeof(((SequenceHeader*)0)->magic)) ||
+			fwrite(&frames, sizeof(frames), 1, file) != 1;
+	bool ok = !failed && fclose(file) == 0;
+	if(failed)
+		fclose(file);
+	file = 0;
+	buffer.clear();
+	return ok;
+}
+
+unsigned long long FeatureStoreWriter::getFrames() const {
+	return frames;
+}
+
+
+FeatureStoreReader::FeatureStoreReader() : dim(0), valueSize(0), padded(true), end(0) {}
+
+bool FeatureStoreReader::open(const string& fileName){
+	mapped.reset();
+	index.clear();
+	dim = 0;
+	end = 0;
+
+	shared_ptr<gmmstd::CMappedFile> file = make_shared<gmmstd::CMappedFile>();
+	if(!file->Open(fileName.c_str()) || file->Size() < sizeof(FileHeader))
+		return false;
+	const char* data = file->Data();
+	size_t size = file->Size();
+
+	FileHeader header;
+	memcpy(&header, data, sizeof(header));
+	if(memcmp(header.magic, fileMagic, sizeof(header.magic)) != 0 || (header.version != version && header.version != 1) ||
+		header.endian != endian || !header.dimension ||
+		(header.valueSize != sizeof(float) && header.valueSize != sizeof(double)))
+		return false;
+	size_t pos = sizeof(header) + (size_t)header.labelSize + header.sourceSize;
+	if(pos > size)
+		return false;
+	labelName.assign(data + sizeof(header), header.labelSize);
+	sourceName.assign(data + sizeof(header) + header.labelSize, header.sourceSize);
+	pos += padding8(pos);
+
+	// indice delle sequenze: da un'intestazione alla successiva
+	size_t recordSize = (size_t)header.dimension*header.valueSize;
+	bool alignedSequences = header.version >= 2;
+	end = pos;
+	for(;;){
+		// ogni intestazione inizia a 8 byte (nella versione 1 subito dopo i frame precedenti)
+		size_t at = alignedSequences ? end + padding8(end) : end;
+		if(at + sizeof(SequenceHeader) > size)
+			break;
+		SequenceHeader seq;
+		memcpy(&seq, data + at, sizeof(seq));
+		if(memcmp(seq.magic, sequenceMagic, sizeof(seq.magic)) != 0)
+			break;
+		size_t first = at + sizeof(seq);
+		size_t available = (size - first) / recordSize;
+		// sequenza non chiusa: prendo i frame completi fino alla fine del file
+		size_t n = (seq.frames == 0 || seq.frames > available) ? available : (size_t)seq.frames;
+		if(!n)
+			break;
+		Sequence s;
+		s.offset = first;
+		s.frames = n;
+		index.push_back(s);
+		end = first + n*recordSize;
+		if(seq.frames == 0)
+			break;
+	}
+
+	dim = header.dimension;
+	valueSize = header.valueSize;
+	padded = alignedSequences;
+	mapped = file;
+	return true;
+}
+
+unsigned int FeatureStoreReader::dimension() const {
+	return dim;
+}
+
+bool FeatureStoreReader::isFloat() const {
+	return valueSize == sizeof(float);
+}
+
+bool FeatureStoreReader::isPadded() const {
+	return padded;
+}
+
+const string& FeatureStoreReader::label() const {
+	return labelName;
+}
+
+const string& FeatureStoreReader::sourceVideo() const {
+	return sourceName;
+}
+
+size_t FeatureStoreReader::sequences() const {
+	return index.size();
+}
+
+size_t FeatureStoreReader::frames(size_t s) const {
+	return index[s].frames;
+}
+
+size_t FeatureStoreReader::sequenceHeader(size_t s) const {
+	return index[s].offset - sizeof(SequenceHeader);
+}
+
+size_t FeatureStoreReader::dataEnd() const {
+	return end;
+}
+
+const float* FeatureStoreReader::floatFrames(size_t s) const {
+	return isFloat() ? (const float*)(mapped->Data() + index[s].offset) : 0;
+}
+
+const double* FeatureStoreReader::doubleFrames(size_t s) const {
+	return isFloat() ? 0 : (const double*)(mapped->Data() + index[s].offset);
+}
+
+void FeatureStoreReader::getSequence(size_t s, vector<vector<double> >& seq) const {
+	size_t n = index[s].frames;
+	seq.resize(n);
+	const float* f = floatFrames(s);
+	const double* d = doubleFrames(s);
+	for(size_t t=0; t<n; ++t){
+		if(f)
+			seq[t].assign(f + t*dim, f + (t+1)*dim);
+		else
+			seq[t].assign(d + t*dim, d + (t+1)*dim);
+	}
+}
@@ -0,0 +1,134 @@
+#pragma once
+
+//C
+#include <stdio.h>
+//C++
+#include <string>
+#include <vector>
+#include <memory>
+
+#include "gmmstd_mapped_file.h"
+
+
+// Feature di training in formato binario: un file per video (training\<categoria>\<video>.feat).
+//   intestazione: magic, versione, endianness, dimensione delle feature, byte per valore
+//                 (4 = float, 8 = double), etichetta (categoria) e nome del video sorgente
+//   sequenze:     ognuna con una piccola intestazione (magic e numero di frame) seguita
+//                 dai frame, record di dimensione fissa (dimension valori ciascuno),
+//                 poi padding fino a 8 byte (serve con float e dimension dispari)
+// Ogni esecuzione sullo stesso video aggiunge una sequenza in fondo al file: le sequenze
+// gia' scritte non vengono toccate. Il reader costruisce l'indice delle sequenze (posizione
+// e numero di frame) saltando da un'intestazione all'altra, senza leggere i record.
+// Tutti i blocchi sono allineati a 8 byte, quindi i record mappati si leggono sul posto.
+// I file della versione 1 non hanno il padding dopo i frame: si leggono ancora, ma con float
+// e dimension dispari si aggiungono sequenze solo ai file nuovi.
+namespace featurestore {
+	const char fileMagic[8] = {'V','A','F','E','A','T','S','1'};
+	const char sequenceMagic[8] = {'V','A','F','E','A','T','S','Q'};
+	const unsigned int version = 2;
+	const unsigned int endian = 0x01020304;
+
+	struct FileHeader {
+		char magic[8];
+		unsigned int version;
+		unsigned int endian;
+		unsigned int dimension;
+		unsigned int valueSize;
+		unsigned int labelSize; // byte dell'etichetta, che segue l'intestazione
+		unsigned int sourceSize; // byte del nome del video, dopo l'etichetta (poi padding a 8 byte)
+	};
+
+	struct SequenceHeader {
+		char magic[8];
+		unsigned long long frames; // 0 se il writer non e' stato chiuso: i frame arrivano fino alla fine del file
+	};
+}
+
+
+// Scrittura bufferizzata delle feature di un video. I frame vengono accumulati in memoria
+// e scritti a blocchi; close (o il distruttore) scarica il buffer e chiude la sequenza.
+class FeatureStoreWriter {
+public:
+	FeatureStoreWriter();
+	~FeatureStoreWriter();
+
+	// Apre (o crea, con la cartella) fileName e inizia una nuova sequenza.
+	// Se il file esiste deve avere stessa dimensione, tipo, etichetta e video.
+	// useFloat: valori salvati in float (meta' spazio) invece che in double.
+	bool open(const std::string& fileName, unsigned int dimension, bool useFloat,
+		const std::string& label, const std::string& sourceVideo);
+
+	bool isOpen() const;
+
+	// aggiunge un frame alla sequenza corrente (features.size() deve essere dimension)
+	bool write(const std::vector<double>& features);
+
+	// scarica il buffer, scrive il numero di frame della sequenza e chiude il file
+	bool close();
+
+	// frame scritti nella sequenza corrente
+	unsigned long long getFrames() const;
+
+private:
+	FeatureStoreWriter(const FeatureStoreWriter&);
+	FeatureStoreWriter& operator=(const FeatureStoreWriter&);
+
+	bool flush();
+
+	FILE* file;
+	unsigned int dimension;
+	unsigned int valueSize;
+	long long sequencePos; // posizione dell'intestazione della sequenza corrente
+	unsigned long long frames;
+	std::vector<char> buffer;
+	std::size_t used;
+	bool failed;
+};
+
+
+// Lettura di un file .feat mappato in memoria: nessun parsing, i frame di una sequenza
+// sono un blocco contiguo di frames(s) x dimension() valori.
+class FeatureStoreReader {
+public:
+	FeatureStoreReader();
+
+	// false se il file non c'e' o non e' valido
+	bool open(const std::string& fileName);
+
+	unsigned int dimension() const;
+	bool isFloat() const; // valori in float (altrimenti double)
+	bool isPadded() const; // sequenze allineate a 8 byte anche dopo i frame (versione 2)
+	const std::string& label() const;
+	const std::string& sourceVideo() const;
+
+	// numero di sequenze e di frame della sequenza s
+	std::size_t sequences() const;
+	std::size_t frames(std::size_t s) const;
+
+	// primo valore della sequenza s (NULL se il file non e' di quel tipo)
+	const float* floatFrames(std::size_t s) const;
+	const double* doubleFrames(std::size_t s) const;
+
+	// posizione (in byte) dell'intestazione della sequenza s e fine dell'ultimo frame completo:
+	// servono al writer per aggiungere una sequenza
+	std::size_t sequenceHeader(std::size_t s) const;
+	std::size_t dataEnd() const;
+
+	// copia la sequenza s in seq (un vector<double> per frame), riusando la memoria di seq
+	void getSequence(std::size_t s, std::vector<std::vector<double> >& seq) const;
+
+private:
+	struct Sequence {
+		std::size_t offset; // byte del primo frame dall'inizio del file
+		std::size_t frames;
+	};
+
+	std::shared_ptr<gmmstd::CMappedFile> mapped;
+	unsigned int dim;
+	unsigned int valueSize;
+	bool padded;
+	std::string labelName;
+	std::string sourceName;
+	std::vector<Sequence> index;
+	std::size_t end;
+};
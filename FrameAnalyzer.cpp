@@ -10,6 +10,7 @@
 #include <numeric>
 #include <cstdint>
 #include <cstdlib>
+#include <mutex>
 
 #include "FrameAnalyzer.h"
 #include "dirent.h"
@@ -20,9 +21,15 @@ using namespace std;
 using namespace cv;
 using namespace gmmstd;
 
-FrameAnalyzer::FrameAnalyzer(char* videoFilename, std::string C, int mog)
+// lo stesso file di log puo' essere scritto da piu' video in parallelo
+static mutex logMutex;
+
+FrameAnalyzer::FrameAnalyzer(char* videoFilename, std::string C, int mog, bool headlessMode,
+	HMMBankPtr bank, BackgroundIndexPtr bgIndex, ThreadPoolPtr pool, bool inlineRun)
 	: MOG_LEARNING_RATE(learningRate), STD_SIZE(Size(640,480)), RED(Scalar(0,0,255)), GREEN(Scalar(0,255,0)), BLUE(Scalar(255,0,0)),
-	filename(videoFilename), mogType(mog), category(C){
+	filename(videoFilename), mogType(mog), headless(headlessMode), category(C), backgrounds(bgIndex), hmmBank(bank), scoringPool(pool),
+	inlinePipeline(inlineRun), stopping(false), decodedQueue(pipelineQueueSize), segmentedQueue(pipelineQueueSize), detectedQueue(pipelineQueueSize), classifiedQueue(pipelineQueueSize),
+	recycledQueue(4*pipelineQueueSize + 8), bufferAllocations(0), featureStoreOpened(false), bankProblemReported(false), videoEnded(false){
 
 		// inizializzazione variabili
 		predictionVect = Point2d(0, 0);
@@ -36,13 +43,20 @@ FrameAnalyzer::FrameAnalyzer(char* videoFilename, std::string C, int mog)
 		avgBsTime = 0;
 		avgPdTime = 0;
 
+		keyboard = 0;
+
 		// Inizializzazione utile nel caso non trovi contorni
 		frameResized = Mat3b(STD_SIZE.height, 250);
 
+		int morph_size = 3;
+		morphElement = getStructuringElement( MORPH_CROSS, Size( 2*morph_size + 1, 2*morph_size+1 ), Point( morph_size, morph_size ) );
+
 		// crea le finestre dell'interfaccia
-		namedWindow("Frame");
-		namedWindow("FG Mask MOG");
-		namedWindow("Background Subtraction and People Detector");
+		if(!headless){
+			namedWindow("Frame");
+			namedWindow("FG Mask MOG");
+			namedWindow("Background Subtraction and People Detector");
+		}
 
 		// impostazione del background suppressor
 		switch (mogType){
@@ -57,6 +71,10 @@ FrameAnalyzer::FrameAnalyzer(char* videoFilename, std::string C, int mog)
 
 		// inizializzo il background
 		bgName = getBgName(filename);
+		if(!openError.empty()){
+			cerr << openError << endl;
+			return;
+		}
 		cout << "Background selezionato: " << bgName << endl;
 
 		VideoCapture bgCapture(bgName);
@@ -68,11 +86,10 @@ FrameAnalyzer::FrameAnalyzer(char* videoFilename, std::string C, int mog)
 				frameInit = pic;
 			}
 			else{
-				// errore nell'aprire il file di background
-				cerr << "Impossibile aprire il file di background: " << bgName << endl;
-				// TODO magari si potrebbe fare qualcosa di pi user-friendly piuttosto che chiudere tutto il programma...
-				system("pause");
-				exit(EXIT_FAILURE);
+				// errore nell'aprire il file di background: cosa fare lo decide il chiamante (vedi isOpened)
+				openError = "Impossibile aprire il file di background: " + bgName;
+				cerr << openError << endl;
+				return;
 			}
 		}
 		else {
@@ -92,44 +109,25 @@ FrameAnalyzer::FrameAnalyzer(char* videoFilename, std::string C, int mog)
 
 		if(!capture.isOpened()){
 			// errore nell'aprire il file in input
-			cerr << "Impossibile aprire il file video: " << filename << endl;
-			// TODO magari si potrebbe fare qualcosa di pi user-friendly piuttosto che chiudere tutto il programma...
-			system("pause");
-			exit(EXIT_FAILURE);
+			openError = string("Impossibile aprire il file video: ") + filename;
+			cerr << openError << endl;
+			return;
 		}
-
-		//Carico gli HMM per il testing
-		cout << "Carico HMM per il testing..." << endl;
-		//Cartella con hmm trainati
-		string path = "hmm/";
-		DIR* d;
-		d = opendir(path.c_str());
-		if(!d)
-			cout << "Errore apertura cartella HMM trainati!" << endl;
-		dirent* f;
-		//Per tutti gli hmm presenti
-		while((f = readdir(d))){
-			string tmp;
-			tmp = f->d_name;
-			//Controllo che sia un nome di un file presente
-			if(tmp.compare(".") != 0 && tmp.compare("..") != 0){
-				CHMM_GMM* hmm = new CHMM_GMM(1, 1, 1);
-				string pre = "hmm/"+tmp;
-				char * nome_hmm = new char [pre.length()+1];
-				strcpy_s(nome_hmm, pre.length()+1, pre.c_str());
-				//Carico hmm e controllo esito
-				if(!(hmm->LoadFromFile(nome_hmm))){
-					cout << "Errore caricamento HMM: " << nome_hmm << endl;
-				}
-				//Inserisco hmm nel vettore
-				vhmm.push_back(*hmm);
-				//Memorizzo il tipo di classe dell'hmm
-				class_action.push_back(tmp.substr(tmp.find_first_of("_")+1, (tmp.size())-tmp.find_first_of("_")));
-				//Distruggo l'hmm per non avere problemi di memory allocation
-				hmm->~CHMM_GMM();
-			}
+		frameCount = (int)capture.get(CV_CAP_PROP_FRAME_COUNT);
+		shownFramePos = 0;
+
+		//Thread per valutare i modelli in parallelo
+		if(!scoringPool)
+			scoringPool = make_shared<ThreadPool>(scoringThreads);
+		//Carico gli HMM per il testing (se non sono gia' stati caricati dal chiamante).
+		//Il caricamento va in background: i primi frame vengono intanto decodificati e
+		//segmentati, solo classifyFrame aspetta che la banca sia pronta
+		if(!hmmBank){
+			cout << "Carico HMM per il testing..." << endl;
+			//Cartella con hmm trainati
+			hmmBank = make_shared<HMMBank>();
+			hmmBank->loadAsync(hmmBankFile, "hmm/", scoringPool.get());
 		}
-		cout << "Sono stati caricati " << vhmm.size() << " HMM" << endl;
 
 		// inizializzo il contatore dei test effettuati
 		testCount = 0;
@@ -139,18 +137,23 @@ FrameAnalyzer::FrameAnalyzer(char* videoFilename, std::string C, int mog)
 		//Creo vettore con etichette per prestazioni
 		fillGroundTruth(performance, filename, "groundTruth.txt");
 
+		// da qui in poi capture e' usato solo dal thread di decode
+		// (senza pipeline gli stadi girano su chi chiama processFrame)
+		if(!inlinePipeline)
+			startPipeline();
 }
 
+// capture appartiene al thread di decode: qui si usano solo i valori gia' letti
 int FrameAnalyzer::getFrameCount(){
-	if(capture.isOpened()){
-		return (int)capture.get(CV_CAP_PROP_FRAME_COUNT);
+	if(isOpened()){
+		return frameCount;
 	}
 	else return -1;
 }
 
 int FrameAnalyzer::getCurrentFramePos(){
-	if(capture.isOpened()){
-		return (int)capture.get(CV_CAP_PROP_POS_FRAMES);
+	if(isOpened()){
+		return shownFramePos;
 	}
 	else return -1;
 }
@@ -160,6 +163,8 @@ const VideoCapture& FrameAnalyzer::getCapture(){
 }
 
 void FrameAnalyzer::release(){
+	//fermo la pipeline prima di chiudere capture
+	stop();
 	//delete capture object
 	capture.release();
 }
@@ -170,25 +175,182 @@ bool FrameAnalyzer::processFrame() {
 	//cerr << endl << "FILE: " << filename << endl;
 	//cerr << "CURRENT FRAME: " << getCurrentFramePos() << " / " << getFrameCount() << "\t";
 
-	//read the current frame
-	if(!capture.read(frame)) {
+	// video non aperto o gia' finito: non c'e' nessuno stadio che produca frame
+	// (dopo l'ultimo job aspettare su classifiedQueue bloccherebbe per sempre)
+	if(!isOpened() || videoEnded)
+		return false;
+
+	// prendo il primo frame gia' classificato (nello stesso ordine del video)
+	FrameJob* job;
+	if(inlinePipeline)
+		job = runStagesInline();
+	else if(!popJob(classifiedQueue, job)){
+		videoEnded = true;
+		return false;
+	}
+
+	if(job->last) {
+		videoEnded = true;
+		delete job;
 		cerr << "Video terminato." << endl;
 		return false; //Altrimenti esce di botto
 	}
 
-	// Resize dei frame in input alla dimensione standard
-	resize(frame, frame, STD_SIZE);
+	shownFramePos = job->framePos;
+	if(!headless)
+		showFrame(*job);
+
+	// il job (con i suoi buffer) torna al decode
+	if(!recycledQueue.tryPush(job))
+		delete job;
+
+	return true;
+}
+
+FrameJob* FrameAnalyzer::runStagesInline(){
+	// stesso lavoro di decodeStage e stageLoop, uno stadio dopo l'altro sul thread chiamante
+	FrameJob* job;
+	if(recycledQueue.tryPop(job))
+		job->reset();
+	else {
+		job = new FrameJob();
+		++bufferAllocations;
+	}
+	job->last = !readFrame(*job);
+	if(!job->last){
+		segmentFrame(*job);
+		detectPerson(*job);
+		classifyFrame(*job);
+	}
+	return job;
+}
+
+void FrameAnalyzer::startPipeline(){
+	stageThreads.push_back(thread(&FrameAnalyzer::decodeStage, this));
+	stageThreads.push_back(thread(&FrameAnalyzer::stageLoop, this, ref(decodedQueue), ref(segmentedQueue), &FrameAnalyzer::segmentFrame));
+	stageThreads.push_back(thread(&FrameAnalyzer::stageLoop, this, ref(segmentedQueue), ref(detectedQueue), &FrameAnalyzer::detectPerson));
+	stageThreads.push_back(thread(&FrameAnalyzer::stageLoop, this, ref(detectedQueue), ref(classifiedQueue), &FrameAnalyzer::classifyFrame));
+}
+
+void FrameAnalyzer::stop(){
+	stopping = true;
+	// sveglio gli stadi (e processFrame) che aspettano su una coda
+	decodedQueue.close();
+	segmentedQueue.close();
+	detectedQueue.close();
+	classifiedQueue.close();
+	for(size_t i=0; i<stageThreads.size(); ++i)
+		stageThreads[i].join();
+	stageThreads.clear();
+	// lo stadio di classificazione e' fermo: chiudo la sequenza del feature store
+	featureStore.close();
+	// il caricamento in background usa scoringPool: deve finire prima che il pool venga distrutto
+	if(hmmBank)
+		hmmBank->wait();
+
+	// libero i frame rimasti nelle code
+	FrameJob* job;
+	while(decodedQueue.tryPop(job)) delete job;
+	while(segmentedQueue.tryPop(job)) delete job;
+	while(detectedQueue.tryPop(job)) delete job;
+	while(classifiedQueue.tryPop(job)) delete job;
+	while(recycledQueue.tryPop(job)) delete job;
+}
+
+void FrameAnalyzer::countAllocation(const Mat& m, const uchar* before){
+	if(m.data != before)
+		++bufferAllocations;
+}
+
+bool FrameAnalyzer::pushJob(BlockingSpscQueue<FrameJob*>& queue, FrameJob* job){
+	return !stopping && queue.push(job);
+}
+
+bool FrameAnalyzer::popJob(BlockingSpscQueue<FrameJob*>& queue, FrameJob*& job){
+	return !stopping && queue.pop(job);
+}
+
+void FrameAnalyzer::decodeStage(){
+	for(;;){
+		// riuso un job gia' mostrato, se non ce ne sono (primi frame) ne creo uno nuovo
+		FrameJob* job;
+		if(recycledQueue.tryPop(job))
+			job->reset();
+		else {
+			job = new FrameJob();
+			++bufferAllocations;
+		}
+		job->last = !readFrame(*job);
+		if(!pushJob(decodedQueue, job)){
+			delete job;
+			return;
+		}
+		if(job->last)
+			return;
+	}
+}
+
+void FrameAnalyzer::stageLoop(BlockingSpscQueue<FrameJob*>& in, BlockingSpscQueue<FrameJob*>& out, void (FrameAnalyzer::*work)(FrameJob&)){
+	for(;;){
+		FrameJob* job;
+		if(!popJob(in, job))
+			return;
+		bool last = job->last;
+		if(!last)
+			(this->*work)(*job);
+		if(!pushJob(out, job)){
+			delete job;
+			return;
+		}
+		// il job di fine video chiude anche questo stadio
+		if(last)
+			return;
+	}
+}
+
+bool FrameAnalyzer::readFrame(FrameJob& job) {
+
+	//read the current frame
+	const uchar* before = job.captured.data;
+	if(!capture.read(job.captured))
+		return false;
+	countAllocation(job.captured, before);
+	job.framePos = (int)capture.get(CV_CAP_PROP_POS_FRAMES);
+
+	// Resize dei frame in input alla dimensione standard (se serve): i due buffer
+	// sono distinti perche' resize sul posto riallocherebbe la destinazione
+	if(job.captured.rows == STD_SIZE.height && job.captured.cols == STD_SIZE.width)
+		swap(job.captured, job.frame);
+	else {
+		before = job.frame.data;
+		resize(job.captured, job.frame, STD_SIZE);
+		countAllocation(job.frame, before);
+	}
 
 	//Per la webcam messa male di mak
-	//flip(frame, frame, -1);
+	//flip(job.frame, job.frame, -1);
 
 	//Copio il frame per ottenere quello su cui disegnare i rettangoli
-	frameDrawn = frame.clone();
+	if(!headless){
+		before = job.frameDrawn.data;
+		job.frame.copyTo(job.frameDrawn);
+		countAllocation(job.frameDrawn, before);
+	}
+
+	return true;
+}
+
+void FrameAnalyzer::segmentFrame(FrameJob& job) {
+
+	Mat& frame = job.frame;
+	Mat& frameDrawn = job.frameDrawn;
+	Mat& fgMaskMOG = job.fgMaskMOG;
 
 	// BACKGROUND SUBTRACTION --------------------------------------------
 
 	double s = (double)getTickCount();
 
+	const uchar* before = fgMaskMOG.data;
 	if(initial){
 		pMOG->operator()(frameInit, fgMaskMOG, MOG_LEARNING_RATE);
 		initial = false;
@@ -198,27 +360,33 @@ bool FrameAnalyzer::processFrame() {
 
 	s = (double)getTickCount() - s;
 	avgBsTime += s*1000./cv::getTickFrequency();
+	countAllocation(fgMaskMOG, before);
 
 	// FILTERING e MORFOLOGIA SU fgMaskMOG per ottenere una silhouette migliore 
 	//dilate(fgMaskMOG, fgMaskMOG, Mat(), Point(-1, -1), 2, 1, 1);
 	// Applica chiusura morfologica per migliorare il risultato della sogliatura
-	int morph_size = 3;
-	Mat element = getStructuringElement( MORPH_CROSS, Size( 2*morph_size + 1, 2*morph_size+1 ), Point( morph_size, morph_size ) );
-	morphologyEx( fgMaskMOG, fgMaskMOG, MORPH_CLOSE, element );
+	morphologyEx( fgMaskMOG, fgMaskMOG, MORPH_CLOSE, morphElement );
 	/*medianBlur(fgMaskMOG, fgMaskMOG, 3);*/
 	// disegna una bounding box BLU attorno alle zone di foreground
-	std::vector<std::vector<cv::Point> > contours;
-	std::vector<std::vector<cv::Point> > inBoundContours;
-	std::vector<cv::Vec4i> hierarchy;
-	// passo un clone di fgMaskMOG per fare in modo che non la modifichi
-	findContours( fgMaskMOG.clone(), contours, hierarchy, RETR_CCOMP, cv::CHAIN_APPROX_TC89_KCOS);
+	// (i vettori sono dello stadio e vengono riusati: clear non libera la memoria)
+	SegmentBuffers& buf = segmentBuffers;
+	buf.clear();
+	std::vector<std::vector<cv::Point> >& contours = buf.contours;
+	std::vector<size_t>& inBoundContours = buf.inBoundContours;
+	std::vector<double>& inBoundAreas = buf.inBoundAreas;
+	// passo una copia di fgMaskMOG per fare in modo che non la modifichi
+	before = job.contourMask.data;
+	fgMaskMOG.copyTo(job.contourMask);
+	countAllocation(job.contourMask, before);
+	findContours( job.contourMask, contours, buf.hierarchy, RETR_CCOMP, cv::CHAIN_APPROX_TC89_KCOS);
 
 	// ---------------------------------------------------------------------------------------------
 	// Trova il centro di massa di ogni contorno (trovato dopo il filtering)
 	// Calcola poi il centroide della nuvola di punti per stabilire il punto centrale del movimento
 	// Se tolti i commenti, in giallo i centri di massa dei contorni. In rosso il centroide complessivo.
-	vector<int> cmContoursX, cmContoursY;
-	int centroidX, centroidY;
+	vector<int>& cmContoursX = buf.cmContoursX;
+	vector<int>& cmContoursY = buf.cmContoursY;
+	int centroidX = 0, centroidY = 0;
 	if(contours.size() > 0) {
 		for ( size_t i=0; i<contours.size(); ++i ){
 			Moments mo = moments(contours[i], true);
@@ -227,41 +395,48 @@ bool FrameAnalyzer::processFrame() {
 			if( IsInBounds(int(result.x), 0, STD_SIZE.width) && IsInBounds(int(result.y), 80, (STD_SIZE.height))){
 				cmContoursX.push_back(result.x);
 				cmContoursY.push_back(result.y);
-				inBoundContours.push_back(contours[i]);
+				inBoundContours.push_back(i);
+				inBoundAreas.push_back(contourArea(contours[i]));
 				// [DEBUG] Disegna la posizione del centro di massa e del boundingRect del contorno
-				rectangle(frameDrawn, boundingRect(contours[i]), Scalar(255,0,0), 1);
-				circle(frameDrawn, result, 3, Scalar(0,255,255), 3);
+				if(!headless){
+					rectangle(frameDrawn, boundingRect(contours[i]), Scalar(255,0,0), 1);
+					circle(frameDrawn, result, 3, Scalar(0,255,255), 3);
+				}
 			}
 		}
 		//cout << "ALL CONTOURS: " << contours.size() << " INBOUND: " << inBoundContours.size() << endl;
 
 		// Trova il contorno di area maggiore per poter dare un maggior peso alla sua posizione
-		int largestContourIndex = -1;
-		int largestArea = -1;
-		for (size_t i=0; i<inBoundContours.size(); ++i) {
-			if(contourArea(inBoundContours[i]) > largestArea) {
-				largestArea = contourArea(inBoundContours[i]);
-				largestContourIndex = i;
+		// (serve solo per il disegno di debug)
+		if(!headless){
+			int largestContourIndex = -1;
+			int largestArea = -1;
+			for (size_t i=0; i<inBoundContours.size(); ++i) {
+				if(inBoundAreas[i] > largestArea) {
+					largestArea = inBoundAreas[i];
+					largestContourIndex = i;
+				}
 			}
+			// [DEBUG] Disegna il boundingRect del contorno di area maggiore
+			if(largestContourIndex >= 0)
+				rectangle(frameDrawn, boundingRect(contours[inBoundContours[largestContourIndex]]), BLUE, 3);
 		}
-		// [DEBUG] Disegna il boundingRect del contorno di area maggiore
-		if(largestContourIndex >= 0)
-			rectangle(frameDrawn, boundingRect(inBoundContours[largestContourIndex]), BLUE, 3);
 
 
 		// CALCOLA LA POSIZIONE DEL CENTROIDE
 		// Le coordinate di ogni centro di massa sono pesate con l'area del rispettivo rettangolo
 		double totAreas = 0.0;
 		centroidX = 0; centroidY = 0;
-		for_each(inBoundContours.begin(), inBoundContours.end(),
-			[&totAreas] (vector<Point> inBoundContour) {totAreas += contourArea(inBoundContour);});
+		for_each(inBoundAreas.begin(), inBoundAreas.end(),
+			[&totAreas] (double area) {totAreas += area;});
 		for(size_t i=0; i<cmContoursX.size(); ++i)
-			centroidX += cmContoursX[i] * contourArea(inBoundContours[i]);
+			centroidX += cmContoursX[i] * inBoundAreas[i];
 		centroidX /= totAreas;
 		for(size_t i=0; i<cmContoursY.size(); ++i)
-			centroidY += cmContoursY[i] * contourArea(inBoundContours[i]);
+			centroidY += cmContoursY[i] * inBoundAreas[i];
 		centroidY /= totAreas;
-		circle(frameDrawn, Point2d(centroidX, centroidY), 7, RED, 3);
+		if(!headless)
+			circle(frameDrawn, Point2d(centroidX, centroidY), 7, RED, 3);
 
 
 
@@ -275,27 +450,43 @@ bool FrameAnalyzer::processFrame() {
 
 		// Se il centroide  all'interno del frame, ritaglia la ROI
 		if (IsInBounds(centroidX, 0, STD_SIZE.width) && IsInBounds(centroidY, 0, STD_SIZE.height)) {
-			Rect newRect = Rect(leftX, 0, abs(rightX-leftX), STD_SIZE.height);
-			frameResized = Mat3b(STD_SIZE.height, 260);
-			frameResized = frame(newRect);
-
-
+			roiRect = Rect(leftX, 0, abs(rightX-leftX), STD_SIZE.height);
 		}
 	}
 	// ---------------------------------------------------------------------------------------------
 
+	// la ROI resta quella dell'ultimo frame in cui e' stata trovata, ritagliata (senza copia)
+	// dal frame corrente: i frame precedenti sono gia' stati riusati
+	if(roiRect.area() > 0)
+		job.frameResized = frame(roiRect);
+	else
+		job.frameResized = frameResized;
+	job.leftX = leftX;
+	job.centroidX = centroidX;
+	job.centroidY = centroidY;
+}
+
+void FrameAnalyzer::detectPerson(FrameJob& job) {
+
+	Mat& frameDrawn = job.frameDrawn;
+	Mat& fgMaskMOG = job.fgMaskMOG;
+	int centroidX = job.centroidX;
+	int centroidY = job.centroidY;
 
 	// HOG PEOPLE DETECTION ------------------------------------------------------------------------
 	bool ped_found = false;
 	// people detection solo sui frame pari
-	if(((int)capture.get(CV_CAP_PROP_POS_FRAMES)) % 4 == 0)	{
+	if(job.framePos % 4 == 0)	{
 
-		vector<Rect> found, found_filtered;
+		vector<Rect>& found = detectBuffers.found;
+		vector<Rect>& found_filtered = detectBuffers.foundFiltered;
+		found.clear();
+		found_filtered.clear();
 		double t = (double)getTickCount();
 		// run the detector with default parameters. to get a higher hit-rate
 		// (and more false alarms, respectively), decrease the hitThreshold and
 		// groupThreshold (set groupThreshold to 0 to turn off the grouping completely).
-		hog.detectMultiScale(frameResized, found, 0, Size(8,8), Size(0,0), 1.05, 1);
+		hog.detectMultiScale(job.frameResized, found, 0, Size(8,8), Size(0,0), 1.05, 1);
 		t = (double)getTickCount() - t; 
 		//cout << "detection time = " << t*1000./cv::getTickFrequency() << " - found objects: " << found.size() << endl;
 		avgPdTime += t*1000./cv::getTickFrequency();
@@ -317,7 +508,7 @@ bool FrameAnalyzer::processFrame() {
 
 			ped_found = true;
 
-			xOffset = leftX;
+			xOffset = job.leftX;
 
 			Point2d movementCentroid(centroidX, centroidY);
 
@@ -344,7 +535,8 @@ bool FrameAnalyzer::processFrame() {
 			closestRect = tmpClosestRect;
 
 			// Disegna il rettangolo sul frame
-			drawRectOnFrameDrawn(closestRect, frameDrawn, GREEN, 4, xOffset);
+			if(!headless)
+				drawRectOnFrameDrawn(closestRect, frameDrawn, GREEN, 4, xOffset);
 
 		}
 		else {
@@ -353,7 +545,8 @@ bool FrameAnalyzer::processFrame() {
 				ped_found = true;
 				closestRect.x += predictionVect.x;
 				closestRect.y += predictionVect.y;
-				drawRectOnFrameDrawn(closestRect, frameDrawn, GREEN, 4, xOffset);
+				if(!headless)
+					drawRectOnFrameDrawn(closestRect, frameDrawn, GREEN, 4, xOffset);
 
 			}
 		}
@@ -365,118 +558,175 @@ bool FrameAnalyzer::processFrame() {
 			closestRect.x += predictionVect.x;
 			closestRect.y += predictionVect.y;
 			// Disegna il rettangolo sul frame
-			drawRectOnFrameDrawn(closestRect, frameDrawn, GREEN, 4, xOffset);
+			if(!headless)
+				drawRectOnFrameDrawn(closestRect, frameDrawn, GREEN, 4, xOffset);
 		}
 	}
 
 	// Creo un rettangolo che contiene la silhouette del soggetto, su cui sono calcolate le features
-	//Trovo sulla mask i pixel di foreground (diversi da 0)
-	Mat nonZeroCoordinates;
-	findNonZero(fgMaskMOG,nonZeroCoordinates);
+	//Trovo sulla mask i pixel di foreground (diversi da 0): dalle proiezioni su righe e colonne
+	//si ricavano il loro numero e il bounding box, senza creare la lista dei punti
+	projectSilhouette(fgMaskMOG, job.maskRows, job.maskCols);
+	int nonZeroCount = 0;
+	int top = -1, bottom = -1, left = -1, right = -1;
+	for(int r=0; r<(int)job.maskRows.size(); ++r){
+		if(job.maskRows[r] == 0)
+			continue;
+		nonZeroCount += job.maskRows[r];
+		if(top < 0)
+			top = r;
+		bottom = r;
+	}
+	for(int c=0; c<(int)job.maskCols.size(); ++c){
+		if(job.maskCols[c] == 0)
+			continue;
+		if(left < 0)
+			left = c;
+		right = c;
+	}
 
 	//Controllo che ci siano effettivamente almeno un po' di punti di foreground (soglia manuale magari da migliorare)
-	if(nonZeroCoordinates.rows>=4 && ped_found){
+	if(nonZeroCount>=4 && ped_found){
 		ped_found = false;
-		Rect bb = boundingRect(nonZeroCoordinates);		
+		Rect bb(left, top, right-left+1, bottom-top+1);
 		//Controllo che il bb non abbia preso troppo frame (a causa del background non ancora riconosciuto)
 		if(bb.x != 0 && bb.y != 0){
-			Mat boundingBox = fgMaskMOG(bb).clone();
-			rectangle(frameDrawn,bb,Scalar(255,255,255),1);
+			// vista sulla maschera: computeFeatureVector la legge soltanto
+			Mat boundingBox = fgMaskMOG(bb);
+			if(!headless)
+				rectangle(frameDrawn,bb,Scalar(255,255,255),1);
 
 			// -------------------- CALCOLO DELL'ISTOGRAMMA--------------------------------
 			int numberBins = 20; // numero di bin del feature vector (sar costituito concatenando due vettori da 10)
-			vector<double> featureVector(numberBins, 0);
+			job.featureVector.assign(numberBins, 0);
+			if(!headless)
+				job.histogramImages.resize(2);
 
-			vector<Mat> histogramImages(2);
-			if(getCurrentFramePos()%1 == 0) {
+			if(job.framePos%1 == 0) {
 				//fgMaskMOG -> versione vecchia, boundingBox -> versione nuova
-				computeFeatureVector(boundingBox, numberBins, featureVector, histogramImages, true);
-				if(!test){ //Se non  un test calcolo i file di train
-					string fName(filename);
-					fName = fName.substr(fName.find_last_of("/\\")+1);
-					fName.replace(fName.find("."),fName.length(), ".txt"); 
-					writeFeatureVectorToFile(category, fName, featureVector);
-					//computeFeatureVector ( fgMaskMOG, closestRect, numberBins, featureVector, histogramImages, createThe2HistogramImages );
+				computeFeatureVector(boundingBox, numberBins, job.featureVector, job.histogramImages, !headless);
+				job.featureValid = true;
+			}
+		}
+	}
+}
+
+void FrameAnalyzer::classifyFrame(FrameJob& job) {
+
+	if(!job.featureValid)
+		return;
+
+	vector<double>& featureVector = job.featureVector;
+	int framePos = job.framePos;
+
+	if(!test){ //Se non  un test calcolo i file di train
+		//Un feature store per video: training\<categoria>\<video>.feat (chiuso da stop)
+		if(!featureStoreOpened){
+			featureStoreOpened = true;
+			string videoName(filename);
+			videoName = videoName.substr(videoName.find_last_of("/\\")+1);
+			string fName = videoName.substr(0, videoName.find(".")) + ".feat";
+			featureStore.open("training\\" + category + "\\" + fName, (unsigned int)featureVector.size(), featureStoreFloat, category, videoName);
+		}
+		featureStore.write(featureVector);
+		//computeFeatureVector ( fgMaskMOG, closestRect, numberBins, featureVector, histogramImages, createThe2HistogramImages );
+	}
+	else{
+		double maxLk = DBL_MIN;
+		string maxClass = "";
+
+		// banca caricata in background dal costruttore: senza modelli non c'e' niente da classificare
+		// (HMMTester sceglie il migliore tra i modelli della banca, che deve avere almeno un modello)
+		if(!hmmBank->wait() || hmmBank->size() == 0){
+			if(!bankProblemReported){
+				bankProblemReported = true;
+				cout << "Nessun HMM caricato: classificazione disattivata per " << filename << endl;
+			}
+			return;
+		}
+
+		if (vHMMTester.size() < windowNum && (testCount % windowsStep)==0){
+			vHMMTester.push_back(HMMTester(hmmBank, scoringPool, rand()%100, filename));
+		}
+
+		// le GMM di tutti i modelli sono valutate una volta sola per frame
+		if(!hmmBank->computeEmissions(featureVector, logEmissions, scoringPool.get())){
+			if(!bankProblemReported){
+				bankProblemReported = true;
+				cout << "Feature di dimensione " << featureVector.size() << ", gli HMM ne vogliono " << hmmBank->featureSize()
+					<< ": classificazione disattivata per " << filename << endl;
+			}
+			return;
+		}
+
+		for (size_t i=0; i<vHMMTester.size(); ++i){
+			string res = vHMMTester[i].testingHMM(logEmissions);
+			//cout << "Confronto: " << res << " e " << performance[framePos] << endl;
+			if(res.compare("nullo") == 0){
+			} 
+			//Confronto etichetta data di mezza finestra prima con classificazione data
+			else{//se ho almeno tot frame
+				//res potrebbe terminare con un numero per via dei nomi del dataset, elimino questa possibilit
+				char c = (char)res[res.size()-1];
+				if( (c>48 && c<57) && res.compare("wave1") != 0 && res.compare("wave2") != 0){
+					res = res.substr(0, res.size()-1);
 				}
-				else{
-					double maxLk = DBL_MIN;
-					string maxClass = "";
-
-					if (vHMMTester.size() < windowNum && (testCount % windowsStep)==0){
-						vHMMTester.push_back(HMMTester(vhmm, class_action, rand()%100, filename));
-					}
-
-					for (size_t i=0; i<vHMMTester.size(); ++i){
-						string res = vHMMTester[i].testingHMM(featureVector);
-						//cout << "Confronto: " << res << " e " << performance[getCurrentFramePos()] << endl;
-						if(res.compare("nullo") == 0){
-						} 
-						//Confronto etichetta data di mezza finestra prima con classificazione data
-						else{//se ho almeno tot frame
-							//res potrebbe terminare con un numero per via dei nomi del dataset, elimino questa possibilit
-							char c = (char)res[res.size()-1];
-							if( (c>48 && c<57) && res.compare("wave1") != 0 && res.compare("wave2") != 0){
-								res = res.substr(0, res.size()-1);
-							}
-							if(res.compare(performance[getCurrentFramePos()-(windowSize/2)]) == 0){
-								ok++;
-								tot_classified++;
-								if(tot_classified!=0 /*&& (getCurrentFramePos() == getFrameCount())*/)
-									cout << "CORRETTO \t SCORE: " << ok << "/" << tot_classified << ",\t" << ((double)ok/(double)tot_classified)*100 << " %" << endl << endl;
-								printLog("out_log.txt", res, performance[getCurrentFramePos()-(windowSize/2)]);
-							}
-							else if(res.compare(performance[getCurrentFramePos()-(windowSize/2)]) != 0){
-								tot_classified++;
-								cout << "ERRORE   \t SCORE: " << ok << "/" << tot_classified << ",\t" << ((double)ok/(double)tot_classified)*100 << " %" << endl << endl;
-								printLog("out_log.txt", res, performance[getCurrentFramePos()-(windowSize/2)]);
-							}
-						}
-
-						/*pair<double,string> c = vHMMTester[i].getClassification();
-						if(c.first > maxLk){
-						maxLk = c.first;
-						maxClass = c.second;
-						}*/
-
-						if (vHMMTester[i].countFrame() == windowSize){
-							vHMMTester.erase(vHMMTester.begin());
-							vHMMTester.push_back(HMMTester(vhmm, class_action, rand()%100, filename));
-						}
-
-						//cout << "Classificatore " << i << " - LK: " <<  c.first << "\tClass: " << c.second << "\tID: " << vHMMTester[i]._id << "\tcon frame:" << vHMMTester[i].countFrame() << endl;
-					}
-
-					//cout << "\tCLASSIFICAZIONE: " << maxClass << " con likelihood: " << maxLk << endl << endl;
-					//cout << getCurrentFramePos() << endl;
-					testCount++;
-					
+				if(res.compare(performance[framePos-(windowSize/2)]) == 0){
+					ok++;
+					tot_classified++;
+					if(tot_classified!=0 /*&& (framePos == getFrameCount())*/)
+						cout << "CORRETTO \t SCORE: " << ok << "/" << tot_classified << ",\t" << ((double)ok/(double)tot_classified)*100 << " %" << endl << endl;
+					printLog("out_log.txt", res, performance[framePos-(windowSize/2)], framePos);
 				}
+				else if(res.compare(performance[framePos-(windowSize/2)]) != 0){
+					tot_classified++;
+					cout << "ERRORE   \t SCORE: " << ok << "/" << tot_classified << ",\t" << ((double)ok/(double)tot_classified)*100 << " %" << endl << endl;
+					printLog("out_log.txt", res, performance[framePos-(windowSize/2)], framePos);
+				}
+			}
 
+			/*pair<double,string> c = vHMMTester[i].getClassification();
+			if(c.first > maxLk){
+			maxLk = c.first;
+			maxClass = c.second;
+			}*/
 
-				// Disegna gli istogrammi
-				for(size_t i=0; i<histogramImages.size(); ++i)
-					imshow("Histogram "+to_string(i+1), histogramImages[i]);
+			if (vHMMTester[i].countFrame() == windowSize){
+				vHMMTester.erase(vHMMTester.begin());
+				vHMMTester.push_back(HMMTester(hmmBank, scoringPool, rand()%100, filename));
 			}
 
-
+			//cout << "Classificatore " << i << " - LK: " <<  c.first << "\tClass: " << c.second << "\tID: " << vHMMTester[i]._id << "\tcon frame:" << vHMMTester[i].countFrame() << endl;
 		}
+
+		//cout << "\tCLASSIFICAZIONE: " << maxClass << " con likelihood: " << maxLk << endl << endl;
+		//cout << framePos << endl;
+		testCount++;
+		
 	}
+}
 
-	//show the current frame and the fg masks
-	imshow("Frame", frame);
-	imshow("frameResized", frameResized);
-	imshow("FG Mask MOG - Silhouette", fgMaskMOG);
-	imshow("Background Subtraction and People Detector", frameDrawn);
+void FrameAnalyzer::showFrame(FrameJob& job) {
 
-	return true;
+	// Disegna gli istogrammi
+	if(job.featureValid)
+		for(size_t i=0; i<job.histogramImages.size(); ++i)
+			imshow("Histogram "+to_string(i+1), job.histogramImages[i]);
+
+	//show the current frame and the fg masks
+	imshow("Frame", job.frame);
+	imshow("frameResized", job.frameResized);
+	imshow("FG Mask MOG - Silhouette", job.fgMaskMOG);
+	imshow("Background Subtraction and People Detector", job.frameDrawn);
 }
 
-void FrameAnalyzer::printLog(string nome, string classified, string real){
+void FrameAnalyzer::printLog(string nome, string classified, string real, int framePos){
+	lock_guard<mutex> lock(logMutex);
 	ofstream out_log(nome, fstream::out | fstream::app);
 
 	int b, e;
-	b = getCurrentFramePos()-(windowSize);
-	e = getCurrentFramePos();
+	b = framePos-(windowSize);
+	e = framePos;
 
 	for(int i=b;i<e;++i){
 		out_log << performance[i].substr(0, 1);
@@ -495,26 +745,18 @@ void FrameAnalyzer::drawRectOnFrameDrawn( Rect closestRect, Mat frameDrawn, cv::
 }
 
 string FrameAnalyzer::getBgName(char* filename){
-	string path = "backgrounds/";
-	vector<string> name_bg;
-
-	DIR* dir;
-	dir = opendir(path.c_str());
-
-	//Carico il vettore con i nomi dei file presenti nella cartella backgrounds
-	if(dir){
-		dirent* file;
-		while((file = readdir(dir))){
-			string tmp = file->d_name;
-			if( (tmp.compare(".") != 0) && (tmp.compare("..") != 0) && (tmp.compare("Thumbs.db") != 0)){
-				name_bg.push_back(tmp);
-			}
+
+	//Indice dei background (letto qui solo se non e' stato passato dal chiamante)
+	if(!backgrounds){
+		backgrounds = make_shared<BackgroundIndex>();
+		if(!backgrounds->loadFromDirectory("backgrounds/")){
+			openError = "Percorso cartella background errato!";
+			return "";
 		}
 	}
-	else{
-		cout << "Percorso cartella background errato!" << endl;
-		system("pause");
-		exit(EXIT_FAILURE);
+	if(backgrounds->size() == 0){
+		openError = "Nessun video di background leggibile!";
+		return "";
 	}
 
 	//Carico il primo frame del video dato in input
@@ -524,61 +766,20 @@ string FrameAnalyzer::getBgName(char* filename){
 		if(file_name.compare("0")==0){
 			return "nullo";
 		}
-		cout << "Impossibile aprire per inizializzare il background il video: " << filename << endl;
-		system("pause");
-		exit(EXIT_FAILURE);
+		openError = string("Impossibile aprire per inizializzare il background il video: ") + filename;
+		return "";
 	}
 	Mat3b frame;
 	video.read(frame);
 
 	//Cerco a quale background assomiglia di pi
-	int min = INT_MAX;
-	string best; 
-
-	//Per ogni video di background
-	for(size_t i=0; i<name_bg.size(); ++i){
-
-		//Apro il video di background
-		string prefix = "backgrounds/";
-		prefix.append(name_bg[i]);
-		VideoCapture vid_bg(prefix); 
-		if(!video.isOpened()){
-			cout << "Impossibile aprire il video di background: " << filename << endl;
-			system("pause");
-			exit(EXIT_FAILURE);
-		}
-		else{
-
-			//Carico il primo fotogramma
-			Mat3b frame_bg;
-			vid_bg.read(frame_bg);
-
-			//Calcolo la distanza
-			int score = 0;
-			for(int c=0; c<frame.cols;++c){
-				for(int r=0; r<frame.rows; ++r){
-					score +=  abs(((int)frame(r,c)[0]) - ((int)frame_bg(r,c)[0]));
-					score +=  abs(((int)frame(r,c)[1]) - ((int)frame_bg(r,c)[1]));
-					score +=  abs(((int)frame(r,c)[2]) - ((int)frame_bg(r,c)[2]));
-				}
-			}
-
-			//Verifico se  la migliore distanza
-			if(score<min){
-				min = score;
-				best = name_bg[i];
-			}
-		}
-	}
-
-	//Costruisco il path corretto
-	path.append(best);
-
-	return path;
+	return backgrounds->bestMatch(frame);
 
 }
 
-FrameAnalyzer::~FrameAnalyzer(void){}
+FrameAnalyzer::~FrameAnalyzer(void){
+	stop();
+}
 
 //void FrameAnalyzer::testingHMM(vector<double> featureVector){
 //
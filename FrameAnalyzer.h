@@ -14,8 +14,15 @@
 #include <cstring>
 #include <string>
 #include <list>
+#include <thread>
+#include <atomic>
 
 #include "HMMTester.h"
+#include "HMMBank.h"
+#include "BackgroundIndex.h"
+#include "ThreadPool.h"
+#include "SpscQueue.h"
+#include "FeatureStore.h"
 
 template <typename T>  bool IsInBounds(const T& value, const T& low, const T& high) {
 	return !(value < low) && !(high < value);
@@ -25,6 +32,44 @@ template <typename T> int sign (T val) {
 	return (T(0)<val) - (val<T(0));
 }
 
+// Tutto quello che la pipeline calcola su un frame. Viene preso dallo stadio di decode
+// e passa di stadio in stadio (decode -> segment -> detect -> classify -> show),
+// quindi ogni stadio lavora sul suo frame senza toccare quelli degli altri.
+// Dopo lo show il job torna allo stadio di decode e viene riusato per un altro frame:
+// i Mat restano allocati e vengono riscritti sul posto finche' non cambia la risoluzione.
+struct FrameJob {
+	int framePos; // posizione nel video dopo la lettura (CV_CAP_PROP_POS_FRAMES)
+	bool last; // fine del video: nessun frame, chiude la pipeline
+
+	cv::Mat captured; // frame come letto da capture (se non e' gia' a STD_SIZE)
+	cv::Mat frame; // frame resizato a STD_SIZE
+	cv::Mat frameDrawn; // frame su cui disegnare i rettangoli
+	cv::Mat fgMaskMOG; // maschera di foreground dopo la morfologia
+	cv::Mat contourMask; // copia di fgMaskMOG per findContours (che modifica l'immagine)
+	cv::Mat frameResized; // ROI attorno al centroide del movimento (vista su frame, input della HOG)
+	int leftX; // bordo sinistro della ROI
+	int centroidX;
+	int centroidY;
+
+	std::vector<int> maskRows, maskCols; // proiezioni di fgMaskMOG, per il bounding box della silhouette
+
+	bool featureValid; // c'e' una silhouette valida e featureVector e' stato calcolato
+	std::vector<double> featureVector;
+	std::vector<cv::Mat> histogramImages;
+
+	FrameJob() { reset(); }
+
+	// azzera i risultati del frame precedente senza liberare i buffer
+	void reset() {
+		framePos = 0;
+		last = false;
+		leftX = 0;
+		centroidX = 0;
+		centroidY = 0;
+		featureValid = false;
+	}
+};
+
 class FrameAnalyzer {
 
 private:
@@ -39,16 +84,18 @@ private:
 	// ------------------ VARIABILI -------------------------------
 	
 	std::string bgName;
+	// motivo per cui il video (o il suo background) non e' stato aperto, vuoto se tutto ok
+	std::string openError;
+	BackgroundIndexPtr backgrounds; // firme dei video di background (condivisibile tra piu' video)
 
 	int mogType;
 
-	cv::Mat frame; //current frame
-	cv::Mat frameDrawn; //frame su cui disegnare i rettangoli
+	// senza finestre: niente imshow, niente disegni su frameDrawn e niente immagini degli istogrammi
+	bool headless;
+
 	cv::Mat frameBg; // frame di background
 	cv::Mat frameInit; //frame di inizializzazione background
 
-	cv::Mat fgMaskMOG; //fg mask generated by MOG method
-
 	cv::Ptr<cv::BackgroundSubtractor> pMOG; //MOG Background subtractor
 
 	cv::HOGDescriptor hog; // Hog detector
@@ -71,20 +118,102 @@ private:
 
 	// Inizializzazione utile nel caso non trovi contorni
 	cv::Mat3b frameResized;
+	// ultima ROI trovata (vuota finche' non si trovano contorni): viene ritagliata dal frame corrente
+	cv::Rect roiRect;
+
+	// elemento strutturante della chiusura morfologica, costruito una volta sola
+	cv::Mat morphElement;
+
+	// Vettori di lavoro degli stadi, riusati da un frame all'altro invece di essere creati
+	// ad ogni frame: dopo i primi frame hanno gia' la capacita' che serve e non allocano piu'.
+	// Ogni struttura e' usata da un solo stadio (quindi da un solo thread).
+	struct SegmentBuffers {
+		std::vector<std::vector<cv::Point> > contours;
+		std::vector<cv::Vec4i> hierarchy;
+		std::vector<size_t> inBoundContours; // indici (in contours) dei contorni con il centro di massa nell'immagine
+		std::vector<double> inBoundAreas; // area dei contorni in inBoundContours
+		std::vector<int> cmContoursX, cmContoursY; // centri di massa dei contorni in inBoundContours
+
+		// svuota senza liberare: i vettori interni di contours restano allocati per findContours
+		void clear() {
+			inBoundContours.clear();
+			inBoundAreas.clear();
+			cmContoursX.clear();
+			cmContoursY.clear();
+		}
+	};
+	SegmentBuffers segmentBuffers; // stadio di segmentazione
+
+	struct DetectBuffers {
+		std::vector<cv::Rect> found;
+		std::vector<cv::Rect> foundFiltered;
+	};
+	DetectBuffers detectBuffers; // stadio di detection
 
 	//Per il TESTING
 	std::vector<std::vector<double>> vfeatures;
-	std::vector<gmmstd::CHMM_GMM> vhmm;
-	std::vector<std::string> class_action;
+	HMMBankPtr hmmBank; // modelli caricati una volta sola e condivisi dai tester
+	bool bankProblemReported; // problema della banca gia' segnalato (una volta sola per video)
+	std::vector<double> logEmissions; // emissioni del frame corrente, condivise da tutti i tester
+	ThreadPoolPtr scoringPool; // thread per la valutazione dei modelli (condiviso dai tester)
 	std::vector<HMMTester> vHMMTester;
 	int testCount;
 	vector<string> performance;
 	int ok;
 	int tot_classified;
 
+	//Per il TRAINING: feature dei frame nel feature store del video (aperto al primo frame)
+	FeatureStoreWriter featureStore;
+	bool featureStoreOpened; // apertura gia' tentata (anche se fallita)
+
+	// ------------------ PIPELINE -------------------------------
+	// Ogni stadio gira su un proprio thread e passa i FrameJob al successivo attraverso
+	// una coda lock-free limitata; lo show resta sul thread chiamante (imshow/waitKey).
+	// Gli stadi sono sequenziali al loro interno, quindi l'ordine dei frame (e lo stato
+	// di MOG, tracking e finestre HMM) e' lo stesso della versione seriale.
+	int frameCount; // letto una volta sola: capture e' usato dal thread di decode
+	int shownFramePos; // posizione dell'ultimo frame restituito da processFrame
+	bool videoEnded; // processFrame ha gia' restituito la fine del video: le code non producono piu' niente
+	// niente thread per gli stadi: processFrame li esegue in fila sul thread chiamante
+	// (usato quando il parallelismo e' gia' tra i video, vedi DatasetRunner)
+	bool inlinePipeline;
+	std::atomic<bool> stopping;
+	// code tra gli stadi: uno stadio senza lavoro dorme invece di occupare un core
+	BlockingSpscQueue<FrameJob*> decodedQueue;
+	BlockingSpscQueue<FrameJob*> segmentedQueue;
+	BlockingSpscQueue<FrameJob*> detectedQueue;
+	BlockingSpscQueue<FrameJob*> classifiedQueue;
+	SpscQueue<FrameJob*> recycledQueue; // job gia' mostrati, dallo show al decode
+	std::vector<std::thread> stageThreads;
+
+	// buffer per frame (job e Mat) allocati o riallocati finora; a regime non cresce piu'
+	std::atomic<unsigned long> bufferAllocations;
+	// conta una (ri)allocazione se il buffer di m non e' piu' quello che aveva prima dell'operazione
+	void countAllocation(const cv::Mat& m, const uchar* before);
+
+	// attesa su code piene/vuote; false se la pipeline e' stata fermata
+	bool pushJob(BlockingSpscQueue<FrameJob*>& queue, FrameJob* job);
+	bool popJob(BlockingSpscQueue<FrameJob*>& queue, FrameJob*& job);
+
+	// corpo dei thread: legge dalla coda in ingresso, elabora e passa allo stadio successivo
+	void decodeStage();
+	void stageLoop(BlockingSpscQueue<FrameJob*>& in, BlockingSpscQueue<FrameJob*>& out, void (FrameAnalyzer::*work)(FrameJob&));
+
+	// lavoro di ogni stadio su un frame
+	bool readFrame(FrameJob& job); // capture.read e resize
+	void segmentFrame(FrameJob& job); // background subtraction, morfologia, contorni, ROI
+	void detectPerson(FrameJob& job); // HOG, tracking, bounding box e feature vector
+	void classifyFrame(FrameJob& job); // finestre HMM (o scrittura del feature store di train)
+	void showFrame(FrameJob& job); // imshow, sul thread chiamante
+
+	void startPipeline();
+	// decode, segment, detect e classify di un frame senza thread (inlinePipeline)
+	FrameJob* runStagesInline();
+
 	void drawRectOnFrameDrawn( cv::Rect closestRect, cv::Mat frameDrawn, cv::Scalar color, int thickness, int xOffset);
+	// "" (con openError impostato) se backgrounds o il video non si aprono
 	std::string getBgName(char* filename);
-	void printLog(string nome, string classified, string real);
+	void printLog(string nome, string classified, string real, int framePos);
 
 public:
 	int keyboard;
@@ -103,12 +232,30 @@ public:
 	// il secondo parametro  la categoria dell'azione (BEND, WALK, RUN ecc) presa dal file dataset.txt
 	// il terzo  il tipo di background suppression (0=MOG, 1=MOG2),
 	// di default sono entrambi a zero cio, lettura da webcam e MOG.
-	FrameAnalyzer(char* filename=0, std::string C="NULL", int mog=0);
+	// Con headless=true non viene aperta nessuna finestra (es: server senza display).
+	// bank, backgrounds e pool permettono di condividere modelli, background e thread tra pi video
+	// (es: elaborazione in parallelo di tutto il dataset); se vuoti vengono creati qui.
+	// Con inlineRun=true gli stadi non hanno thread propri e girano dentro processFrame.
+	// Se il video o il background non si aprono l'oggetto resta vuoto: vedi isOpened/getOpenError.
+	FrameAnalyzer(char* filename=0, std::string C="NULL", int mog=0, bool headless=false,
+		HMMBankPtr bank=HMMBankPtr(), BackgroundIndexPtr backgrounds=BackgroundIndexPtr(), ThreadPoolPtr pool=ThreadPoolPtr(),
+		bool inlineRun=false);
+
+	// false se il costruttore non e' riuscito ad aprire video o background
+	bool isOpened() const { return openError.empty(); }
+	const std::string& getOpenError() const { return openError; }
 
 	// Processa un singolo frame, restituisce true se  andato tutto bene, false se non  riuscita
-	// a leggere un frame dal videoCapture, cio se il video  finito
+	// a leggere un frame dal videoCapture, cio se il video  finito.
+	// In modalit headless il frame non viene mostrato.
+	// Con la pipeline il frame restituito e' il primo uscito dallo stadio di classificazione:
+	// i frame successivi sono gia' in lavorazione sugli altri thread.
+	// Dopo la fine del video ritorna subito false, anche se viene richiamata.
 	bool processFrame();
 
+	// ferma i thread della pipeline (anche a video non finito), da chiamare prima di leggere le statistiche
+	void stop();
+
 	// Da commentare
 	void FrameAnalyzer::testingHMM(std::vector<double> featureVector);
 
@@ -116,12 +263,22 @@ public:
 	// ritorna il numero totale di frame, -1 se qualcosa  andato storto (es: video non aperto)
 	int getFrameCount();
 
-	// ritorna il frame corrente, -1 se qualcosa  andato storto (video finito o non aperto)
+	// ritorna la posizione dell'ultimo frame restituito da processFrame, -1 se il video non  aperto
 	int getCurrentFramePos();
 
 	// chiama release sull'oggetto capture, da fare come ultimissima cosa
 	void release();
 
+	bool isHeadless() const { return headless; }
+
+	// numero di buffer per frame allocati dalla pipeline: dopo i primi frame resta costante,
+	// cresce di nuovo solo se cambia la risoluzione dei buffer
+	unsigned long getBufferAllocations() const { return bufferAllocations; }
+
+	// classificazioni corrette e totali fatte finora (modalit test)
+	int getCorrectCount() const { return ok; }
+	int getClassifiedCount() const { return tot_classified; }
+
 	// ritorna l'oggetto VideoCapture come const, se per caso dovesse servire
 	const cv::VideoCapture & getCapture();
 
@@ -0,0 +1,286 @@
+//C
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+//C++
+#include <iostream>
+#include <sstream>
+#include <algorithm>
+
+#include "HMMBank.h"
+#include "dirent.h"
+
+using namespace std;
+using namespace gmmstd;
+
+HMMBank::HMMBank() : mapped(false), loading(false), loaded(false) {}
+
+HMMBank::~HMMBank(){
+	// non lascio il thread di caricamento a scrivere su un oggetto distrutto
+	wait();
+}
+
+HMMBank::LoadReport::LoadReport() :
+	models(0), failed(0), threads(1), readMs(0), buildMs(0), saveMs(0), totalMs(0) {}
+
+// millisecondi trascorsi da start (preso con getTickCount)
+static double elapsedMs(double start){
+	return ((double)getTickCount() - start)*1000./getTickFrequency();
+}
+
+// File della cartella dei modelli (senza . e ..), nell'ordine di readdir
+static bool listDirectory(const string& path, vector<string>& files){
+	files.clear();
+	DIR* d = opendir(path.c_str());
+	if(!d)
+		return false;
+	dirent* f;
+	while((f = readdir(d))){
+		string tmp;
+		tmp = f->d_name;
+		if(tmp.compare(".") != 0 && tmp.compare("..") != 0)
+			files.push_back(tmp);
+	}
+	closedir(d);
+	return true;
+}
+
+// Descrizione dei file della cartella (nome, dimensione, data di modifica), salvata nel
+// file binario: se cambia vuol dire che i modelli sono stati ritrainati o aggiunti/tolti
+static string directoryStamp(const string& path, vector<string> files){
+	sort(files.begin(), files.end());
+	ostringstream stamp;
+	for(size_t i=0; i<files.size(); ++i){
+		struct stat st;
+		long long fileSize = -1, modified = -1;
+		if(stat((path + files[i]).c_str(), &st) == 0){
+			fileSize = st.st_size;
+			modified = st.st_mtime;
+		}
+		stamp << files[i] << '\n' << fileSize << ' ' << modified << '\n';
+	}
+	return stamp.str();
+}
+
+bool HMMBank::load(const string& bankFile, const string& dirPath, ThreadPool* pool){
+	double start = (double)getTickCount();
+	loaded = loadFromBankFile(bankFile, dirPath);
+	if(!loaded){
+		loaded = loadFromDirectory(dirPath, pool);
+		if(loaded && frozen.IsBuilt()){
+			double t = (double)getTickCount();
+			if(!saveBankFile(bankFile))
+				cout << "Impossibile scrivere il file degli HMM: " << bankFile << endl;
+			report.saveMs = elapsedMs(t);
+		}
+	}
+	report.totalMs = elapsedMs(start);
+	if(loaded)
+		printLoadReport(cout);
+	return loaded;
+}
+
+void HMMBank::loadAsync(const string& bankFile, const string& dirPath, ThreadPool* pool){
+	wait();
+	lock_guard<mutex> lk(loaderMutex);
+	loading = true;
+	loader = thread([this, bankFile, dirPath, pool](){
+		load(bankFile, dirPath, pool);
+	});
+}
+
+bool HMMBank::wait(){
+	// strada veloce: niente loader in corso, la banca e' gia' pronta
+	if(!loading)
+		return loaded;
+	lock_guard<mutex> lk(loaderMutex);
+	if(loader.joinable())
+		loader.join();
+	// dopo il join: chi legge loading == false vede anche tutto quello che ha scritto il loader
+	loading = false;
+	return loaded;
+}
+
+bool HMMBank::loadFromBankFile(const string& bankFile, const string& dirPath){
+	double start = (double)getTickCount();
+	report = LoadReport();
+	vHMM.clear();
+	vEmissionOffset.clear();
+	mapped = frozen.LoadMapped(bankFile.c_str(), classAction, &sourceStamp);
+	// senza la cartella (es: solo il file binario distribuito) il file viene usato cosi' com'e'
+	vector<string> files;
+	if(mapped && !dirPath.empty() && listDirectory(dirPath, files) && directoryStamp(dirPath, files) != sourceStamp){
+		cout << "Il file degli HMM " << bankFile << " non corrisponde a " << dirPath << ": lo ricostruisco" << endl;
+		frozen.Clear();
+		classAction.clear();
+		mapped = false;
+	}
+	report.source = bankFile;
+	report.models = size();
+	report.readMs = report.totalMs = elapsedMs(start);
+	return mapped;
+}
+
+bool HMMBank::saveBankFile(const string& bankFile) const {
+	return frozen.SaveToFile(bankFile.c_str(), classAction, sourceStamp);
+}
+
+bool HMMBank::isMapped() const {
+	return mapped;
+}
+
+bool HMMBank::loadFromDirectory(const string& path, ThreadPool* pool){
+
+	double start = (double)getTickCount();
+	report = LoadReport();
+	report.source = path;
+	mapped = false;
+	vHMM.clear();
+	classAction.clear();
+	sourceStamp.clear();
+
+	//Elenco dei file degli hmm (senza . e ..)
+	vector<string> files;
+	if(!listDirectory(path, files)){
+		cout << "Errore apertura cartella HMM trainati!" << endl;
+		return false;
+	}
+	sourceStamp = directoryStamp(path, files);
+
+	// un modello vuoto per file, costruito direttamente nel vettore: con reserve
+	// non viene mai spostato, quindi ogni thread carica il proprio posto senza copie
+	vHMM.reserve(files.size());
+	for(size_t i=0; i<files.size(); ++i)
+		vHMM.emplace_back(1, 1, 1);
+	vector<char> ok(files.size(), 0);
+
+	auto loadFiles = [&](size_t first, size_t last){
+		for(size_t i=first; i<last; ++i){
+			if(!vHMM[i].LoadFromFile((path + files[i]).c_str()))
+				continue;
+			//Inversa e determinante delle covarianze calcolati una volta per tutte
+			for(unsigned int j=0; j<vHMM[i].m_iN; ++j)
+				vHMM[i].m_B[j].UpdateInverse();
+			ok[i] = 1;
+		}
+	};
+	// un file per blocco: i thread liberi prendono il prossimo file da leggere
+	if(pool){
+		pool->parallelFor(files.size(), loadFiles, 1);
+		report.threads = pool->size();
+	}
+	else
+		loadFiles(0, files.size());
+
+	// tolgo i modelli non caricati (a partire dal fondo, per non cambiare gli indici)
+	for(size_t i=files.size(); i-- > 0; ){
+		if(ok[i])
+			continue;
+		cout << "Errore caricamento HMM: " << path + files[i] << endl;
+		vHMM.erase(vHMM.begin() + i);
+		files.erase(files.begin() + i);
+		++report.failed;
+	}
+
+	//Memorizzo il tipo di classe di ogni hmm
+	for(size_t i=0; i<files.size(); ++i){
+		const string& tmp = files[i];
+		classAction.push_back(tmp.substr(tmp.find_first_of("_")+1, (tmp.size())-tmp.find_first_of("_")));
+	}
+	report.models = size();
+	report.readMs = elapsedMs(start);
+
+	// posizione di ogni modello nella tabella delle emissioni
+	vEmissionOffset.resize(vHMM.size()+1);
+	vEmissionOffset[0] = 0;
+	for(size_t i=0; i<vHMM.size(); ++i)
+		vEmissionOffset[i+1] = vEmissionOffset[i] + vHMM[i].m_iN;
+
+	// copia contigua dei parametri per il testing
+	double t = (double)getTickCount();
+	if(!frozen.Build(vHMM))
+		cout << "Covarianze non diagonali o dimensioni diverse: testing sui modelli non congelati" << endl;
+	report.buildMs = elapsedMs(t);
+	report.totalMs = elapsedMs(start);
+
+	return true;
+}
+
+size_t HMMBank::size() const {
+	return classAction.size();
+}
+
+const CHMM_GMM& HMMBank::getModel(size_t i) const {
+	return vHMM[i];
+}
+
+const string& HMMBank::getClassAction(size_t i) const {
+	return classAction[i];
+}
+
+size_t HMMBank::featureSize() const {
+	if(frozen.IsBuilt())
+		return frozen.GetDimension();
+	return vHMM.empty() ? 0 : vHMM[0].m_iM;
+}
+
+bool HMMBank::computeEmissions(const vector<double>& featureVector, vector<double>& logB, ThreadPool* pool){
+	// le GMM leggono featureSize() elementi del vettore senza controlli
+	if(size() == 0 || featureVector.size() != featureSize())
+		return false;
+	if(!frozen.IsBuilt()){
+		for(size_t i=0; i<vHMM.size(); ++i)
+			if(vHMM[i].m_iM != featureVector.size())
+				return false;
+	}
+	logB.resize(emissionSize());
+	// ogni modello scrive solo i propri stati di logB
+	auto emissions = [&](size_t first, size_t last){
+		if(frozen.IsBuilt()){
+			frozen.ComputeLogEmissions(&featureVector[0], &logB[0], first, last);
+			return;
+		}
+		for(size_t i=first; i<last; ++i)
+			vHMM[i].ComputeLogEmissions(featureVector, &logB[vEmissionOffset[i]]);
+	};
+	if(pool)
+		pool->parallelFor(size(), emissions);
+	else
+		emissions(0, size());
+	return true;
+}
+
+double HMMBank::forwardStep(size_t i, CForwardState& state, const vector<double>& logB) const {
+	if(frozen.IsBuilt())
+		return frozen.ForwardStep(i, state, &logB[frozen.GetEmissionOffset(i)]);
+	return vHMM[i].ForwardStep(state, &logB[vEmissionOffset[i]]);
+}
+
+size_t HMMBank::emissionOffset(size_t i) const {
+	if(frozen.IsBuilt())
+		return frozen.GetEmissionOffset(i);
+	return vEmissionOffset[i];
+}
+
+size_t HMMBank::emissionSize() const {
+	if(frozen.IsBuilt())
+		return frozen.GetEmissionSize();
+	return vEmissionOffset.empty() ? 0 : vEmissionOffset.back();
+}
+
+
+const HMMBank::LoadReport& HMMBank::getLoadReport() const {
+	return report;
+}
+
+void HMMBank::printLoadReport(ostream& out) const {
+	out << "Caricati " << report.models << " HMM da " << report.source;
+	if(mapped)
+		out << " (mappato)";
+	else
+		out << " (" << report.threads << " thread, " << report.failed << " scartati)";
+	out << " in " << report.totalMs << " ms: lettura " << report.readMs << " ms";
+	if(!mapped)
+		out << ", congelamento " << report.buildMs << " ms, scrittura banca " << report.saveMs << " ms";
+	out << endl;
+}
\ No newline at end of file
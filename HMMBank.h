@@ -0,0 +1,129 @@
+#pragma once
+
+//C++
+#include <string>
+#include <ostream>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+
+#include "gmmstd_hmm_GMM.h"
+#include "gmmstd_gmm_tiny.h"
+#include "gmmstd_hmm_frozen.h"
+#include "ThreadPool.h"
+
+
+// Banca dei modelli HMM usati per il testing.
+// Viene caricata una volta sola (nel costruttore di FrameAnalyzer) e condivisa
+// tramite shared_ptr da tutti gli HMMTester: i tester non copiano piu' i modelli,
+// ma tengono solo lo stato della propria finestra.
+// Dopo il caricamento la banca va considerata in sola lettura.
+class HMMBank {
+public:
+	HMMBank();
+	~HMMBank();
+
+	// Carica la banca dal file binario bankFile (es: "hmm.bank"); se non c'e', non e' valido
+	// o non corrisponde piu' ai file di dirPath (nomi, dimensioni e date di modifica, es: dopo
+	// un nuovo training) carica la cartella dirPath (con pool i file vengono letti in parallelo)
+	// e poi riscrive bankFile per le volte successive.
+	bool load(const std::string& bankFile, const std::string& dirPath, ThreadPool* pool = 0);
+
+	// Come load, ma su un thread a parte: ritorna subito, cosi' chi la chiama puo' partire
+	// (es: decodifica e segmentazione dei primi frame) mentre i modelli vengono caricati.
+	// Prima di usare la banca bisogna chiamare wait(). pool non deve essere distrutto prima.
+	void loadAsync(const std::string& bankFile, const std::string& dirPath, ThreadPool* pool = 0);
+
+	// Aspetta la fine di un loadAsync (se c'e') e ritorna l'esito del caricamento.
+	// A caricamento finito non prende piu' il mutex: si puo' chiamare ad ogni frame.
+	bool wait();
+
+	// Carica tutti gli hmm presenti nella cartella indicata (es: "hmm/").
+	// Con pool i file vengono letti in parallelo, ognuno direttamente nel suo posto di vHMM.
+	// I modelli che non si caricano vengono scartati.
+	// Ritorna false se la cartella non si apre.
+	bool loadFromDirectory(const std::string& path, ThreadPool* pool = 0);
+
+	// Mappa in memoria (sola lettura) un file scritto da saveBankFile: i parametri
+	// vengono usati direttamente dal file, senza leggerli ne' convertirli.
+	// Con dirPath il file viene scartato se e' stato scritto da file diversi da quelli attuali.
+	bool loadFromBankFile(const std::string& bankFile, const std::string& dirPath = std::string());
+
+	// Scrive modelli, etichette e l'elenco dei file caricati da loadFromDirectory
+	// in un unico file binario (solo con covarianze diagonali)
+	bool saveBankFile(const std::string& bankFile) const;
+
+	// true se i modelli sono quelli mappati da un file binario
+	bool isMapped() const;
+
+	// numero di modelli caricati
+	std::size_t size() const;
+
+	// i-esimo modello (solo se caricato con loadFromDirectory: dal file binario
+	// ci sono solo i parametri congelati usati per il testing)
+	const gmmstd::CHMM_GMM& getModel(std::size_t i) const;
+
+	// classe dell'i-esimo modello, nella forma "soggetto_azione" (es: daria_bend)
+	const std::string& getClassAction(std::size_t i) const;
+
+	// Cache delle emissioni di un frame: log b_j(O_t) per ogni stato j di ogni modello.
+	// Va calcolata una volta sola quando viene prodotto il feature vector e poi
+	// passata a tutti gli HMMTester attivi, che non rivalutano piu' le GMM.
+	// Se tutte le covarianze sono diagonali lavora sui modelli congelati (frozen).
+	// Con pool i modelli vengono divisi tra i thread.
+	// Ritorna false (logB non calcolata) se featureVector non ha la dimensione dei modelli
+	// (es: banca trainata con un altro vettore di feature).
+	bool computeEmissions(const std::vector<double>& featureVector, std::vector<double>& logB, ThreadPool* pool = 0);
+
+	// dimensione del vettore di feature su cui sono stati trainati i modelli (0 se la banca e' vuota)
+	std::size_t featureSize() const;
+
+	// passo della forward incrementale dell'i-esimo modello sulle emissioni di un frame
+	// (logB = tabella di computeEmissions)
+	double forwardStep(std::size_t i, gmmstd::CForwardState& state, const std::vector<double>& logB) const;
+
+	// posizione in logB del primo stato dell'i-esimo modello
+	std::size_t emissionOffset(std::size_t i) const;
+
+	// dimensione della tabella delle emissioni di un frame (somma degli stati di tutti i modelli)
+	std::size_t emissionSize() const;
+
+	// Tempi dell'ultimo caricamento (in ms)
+	struct LoadReport {
+		std::string source;     // file da cui sono stati presi i modelli (binario o cartella)
+		std::size_t models;     // modelli caricati
+		std::size_t failed;     // file della cartella scartati
+		unsigned int threads;   // thread usati per leggere la cartella
+		double readMs;          // lettura dei modelli (mappatura o file della cartella)
+		double buildMs;         // copia contigua per il testing (solo da cartella)
+		double saveMs;          // scrittura del file binario (solo da cartella)
+		double totalMs;
+		LoadReport();
+	};
+	const LoadReport& getLoadReport() const;
+	void printLoadReport(std::ostream& out) const;
+
+private:
+	HMMBank(const HMMBank&);
+	HMMBank& operator=(const HMMBank&);
+
+	std::vector<gmmstd::CHMM_GMM> vHMM;
+	std::vector<std::string> classAction;
+	std::vector<std::size_t> vEmissionOffset; // vEmissionOffset[i] = somma degli stati dei modelli 0..i-1
+	gmmstd::CHMM_GMM_FrozenSet frozen; // copia in sola lettura di vHMM usata per il testing (vuota se non diagonali)
+	bool mapped; // frozen viene dal file binario, vHMM e' vuoto
+	std::string sourceStamp; // nome, dimensione e data di modifica dei file letti da loadFromDirectory
+	LoadReport report;
+
+	// caricamento in background (loadAsync)
+	std::thread loader;
+	std::mutex loaderMutex; // solo per il join di loader
+	std::atomic<bool> loading; // loadAsync partito e loader non ancora joinato
+	std::atomic<bool> loaded; // esito dell'ultimo caricamento
+};
+
+typedef std::shared_ptr<HMMBank> HMMBankPtr;
+// banca gia' caricata, come la vedono i tester: solo lettura
+typedef std::shared_ptr<const HMMBank> HMMBankConstPtr;
@@ -19,35 +19,72 @@
 #include "config.h"
 #include "gmmstd_hmm_GMM.h"
 #include "gmmstd_gmm_tiny.h"
+#include "HMMBank.h"
+#include "ThreadPool.h"
 
 
+// Classificatore a finestra: valuta windowSize frame consecutivi su tutti i modelli
+// della banca. La banca e' condivisa (non viene copiata), il tester contiene solo
+// lo stato della propria finestra: per ogni modello gli alpha della forward incrementale.
+// Ogni frame costa O(N^2) per modello e il likelihood parziale e' disponibile ad ogni frame.
+// I modelli sono indipendenti: se c'e' un pool la forward viene divisa tra i thread,
+// la scelta del migliore resta sequenziale (stesso ordine dei modelli, risultato deterministico).
 class HMMTester {
 public:
-	std::vector<gmmstd::CHMM_GMM> vHMM;
-	std::vector<std::vector<double>> vFeatures;
-	std::vector<std::string> classAction;
+	HMMBankConstPtr bank;
+	ThreadPoolPtr pool; // puo' essere nullo: tutto sul thread chiamante
+	std::vector<gmmstd::CForwardState> vState; // stato della forward, uno per modello
+	std::size_t nFrames; // frame gia' consumati dalla finestra
 	int best;
 	double loglk;
 	int _id;
 	string filename;
 
-	HMMTester(std::vector<gmmstd::CHMM_GMM> vHMM, std::vector<std::string> classAction, int id, string filename){
-		this->vHMM = vHMM;
-		this->classAction = classAction;
+	HMMTester(HMMBankConstPtr bank, ThreadPoolPtr pool, int id, string filename){
+		this->bank = bank;
+		this->pool = pool;
 		_id = id;
 		this->filename = filename;
+		nFrames = 0;
+		vState.resize(bank->size());
+	}
+
+	// move esplicito (VS2012 non lo genera): aggiungere e togliere tester dalla
+	// finestra sposta gli stati della forward invece di copiarli
+	HMMTester(HMMTester&& ref) GMMSTD_NOEXCEPT :
+		bank(std::move(ref.bank)), pool(std::move(ref.pool)), vState(std::move(ref.vState)),
+		nFrames(ref.nFrames), best(ref.best), loglk(ref.loglk), _id(ref._id), filename(std::move(ref.filename)) {}
+
+	HMMTester& operator=(HMMTester&& ref) GMMSTD_NOEXCEPT {
+		bank = std::move(ref.bank);
+		pool = std::move(ref.pool);
+		vState = std::move(ref.vState);
+		nFrames = ref.nFrames;
+		best = ref.best;
+		loglk = ref.loglk;
+		_id = ref._id;
+		filename = std::move(ref.filename);
+		return *this;
 	}
 
 	std::size_t HMMTester::countFrame () {
-		return vFeatures.size();
+		return nFrames;
+	}
+
+	// log likelihood dell'i-esimo modello sui frame visti finora
+	double HMMTester::getLogLikelihood (std::size_t i) {
+		return vState[i].m_dLogProb;
 	}
 
 	std::pair<double, std::string> HMMTester::getClassification (){
-		std::string c = classAction[best].substr(classAction[best].find_first_of("_")+1, classAction[best].length()-classAction[best].find_first_of("_"));
+		const std::string& bestClass = bank->getClassAction(best);
+		std::string c = bestClass.substr(bestClass.find_first_of("_")+1, bestClass.length()-bestClass.find_first_of("_"));
 		return std::pair<double,std::string>(loglk, c); 
 	}
 
-	string HMMTester::testingHMM(std::vector<double> featureVector){
+	// logEmissions: emissioni del frame corrente per tutti i modelli (vedi HMMBank::computeEmissions),
+	// calcolate una volta sola e condivise da tutti i tester
+	string HMMTester::testingHMM(const std::vector<double>& logEmissions){
 
 		//-----------------TESTING----------------------
 		//Fatto solo se c' una bounding box valida (DA OTTIMIZZARE)
@@ -57,27 +94,27 @@ public:
 		double max_other = DBL_MIN;
 		best = 0;
 
-		//Accumulo le features frame per frame
-		vFeatures.push_back(featureVector);
+		//Aggiorno la forward di ogni modello con il nuovo frame
+		auto step = [&](std::size_t first, std::size_t last){
+			for(std::size_t i=first;i<last;++i)
+				bank->forwardStep(i, vState[i], logEmissions);
+		};
+		if(pool)
+			pool->parallelFor(bank->size(), step);
+		else
+			step(0, bank->size());
+		nFrames++;
 
 		//Classifico solamente quando ho caricato un'intera finestra
-		if(vFeatures.size() == windowSize){
+		if(nFrames == windowSize){
 
 			//Per ogni HMM trovato nella cartella
-			for(int i=0;i<vHMM.size();++i){
-
-				//Ottengo matrice di transizione
-				cv::Mat_<double> A;
-				A = vHMM[i].m_A; 
-
-				//Valuto l'HMM
-				typedef std::vector<std::vector<double>>::iterator iter_vf;
-				const iter_vf ivf_init = vFeatures.begin();
-				const iter_vf ivf_final = vFeatures.end();
-				//Calcolo la logLikelihood
-				//cout << "Calcolo la logLikelihood dell'HMM: " << tmp  << " basandomi su: " << vFeatures.size() << " frame" << endl;
-				//cout << "Calcolo lk con frame " << vFeatures.size() << endl;
-				loglk = vHMM[i].LogLikelihood(ivf_init, ivf_final, &A);
+			for(int i=0;i<bank->size();++i){
+
+				const std::string& hmmClass = bank->getClassAction(i);
+
+				//LogLikelihood della finestra, gia' calcolata frame per frame
+				loglk = vState[i].m_dLogProb;
 				//cout << tmp << "\t" << loglk << endl;
 
 				//Genero alcune stringhe utili (attualmente usate come base per altre stringhe utili)
@@ -87,19 +124,20 @@ public:
 
 				//Ottengo i nomi del soggetto che compie l'azione
 				string action_name = file_name.substr(file_name.find_last_of("_")+1, file_name.size()-file_name.find_last_of("_"));
-				string hmm_name = classAction[i].substr(0, classAction[i].find_first_of("_"));
+				string hmm_name = hmmClass.substr(0, hmmClass.find_first_of("_"));
 				
 				//Memorizzo i valori solo in base alla tecnica del LOO
 				if(action_name.compare(hmm_name) != 0){
 					//Verifico se  massimo e se l'hmm non  lo stesso dell'azione
-					if((loglk>max && loglk==loglk) && (classAction[i].compare(file_name) != 0)){
+					if((loglk>max && loglk==loglk) && (hmmClass.compare(file_name) != 0)){
 						max = loglk;
 						best = i;
 					}
 
 					//Ottengo la classe dell'hmm pi forte e la classe dell'hmm pi forte di classe differente
-					string hmm_in = classAction[i].substr(classAction[i].find_first_of("_")+1, classAction[i].length()-classAction[i].find_first_of("_"));
-					string tipo = classAction[best].substr(classAction[best].find_first_of("_")+1, classAction[best].length()-classAction[best].find_first_of("_"));
+					string hmm_in = hmmClass.substr(hmmClass.find_first_of("_")+1, hmmClass.length()-hmmClass.find_first_of("_"));
+					const std::string& bestClass = bank->getClassAction(best);
+					string tipo = bestClass.substr(bestClass.find_first_of("_")+1, bestClass.length()-bestClass.find_first_of("_"));
 					//string tipo_file = file_name.substr(file_name.find_first_of("_")+1, file_name.length()-file_name.find_first_of("_"));
 					//cout << tipo << "\t" << hmm_in << endl;
 
@@ -110,7 +148,8 @@ public:
 
 			}//fine while
 			
-			string action_classified = classAction[best].substr(classAction[best].find_first_of("_")+1, classAction[best].length()-classAction[best].find_first_of("_"));
+			const std::string& bestClass = bank->getClassAction(best);
+			string action_classified = bestClass.substr(bestClass.find_first_of("_")+1, bestClass.length()-bestClass.find_first_of("_"));
 			if(((max/max_other)*100)>lk_thresh){
 				cout << "CLASSIFICAZIONE: " << action_classified << endl;
 				cout << " SICUREZZA: " << (max/max_other)*100  << endl;
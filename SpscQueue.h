@@ -0,0 +1,151 @@
+#pragma once
+
+//C++
+#include <vector>
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <condition_variable>
+
+
+// Coda circolare a capacita' fissa, lock-free, per UN produttore e UN consumatore
+// (es: due stadi consecutivi della pipeline di FrameAnalyzer).
+// tryPush/tryPop non si bloccano mai: ritornano false se la coda e' piena/vuota.
+// L'ordine degli elementi e' quello di inserimento.
+template <typename T>
+class SpscQueue {
+public:
+	// capacity viene arrotondata alla potenza di 2 successiva
+	explicit SpscQueue(std::size_t capacity) : head(0), tail(0) {
+		std::size_t size = 2;
+		while(size < capacity)
+			size <<= 1;
+		buffer.resize(size);
+		mask = size - 1;
+	}
+
+	// solo dal thread produttore
+	bool tryPush(const T& value){
+		const std::size_t t = tail.load(std::memory_order_relaxed);
+		if(t - head.load(std::memory_order_acquire) > mask)
+			return false; // piena
+		buffer[t & mask] = value;
+		tail.store(t + 1, std::memory_order_release);
+		return true;
+	}
+
+	// solo dal thread consumatore
+	bool tryPop(T& value){
+		const std::size_t h = head.load(std::memory_order_relaxed);
+		if(h == tail.load(std::memory_order_acquire))
+			return false; // vuota
+		value = buffer[h & mask];
+		head.store(h + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool empty() const {
+		return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+	}
+
+	std::size_t capacity() const {
+		return mask + 1;
+	}
+
+private:
+	SpscQueue(const SpscQueue&);
+	SpscQueue& operator=(const SpscQueue&);
+
+	std::vector<T> buffer;
+	std::size_t mask;
+	// head e tail su linee di cache diverse: produttore e consumatore non si contendono la stessa linea
+	char pad0[64];
+	std::atomic<std::size_t> head; // prossimo elemento da leggere (scritto dal consumatore)
+	char pad1[64];
+	std::atomic<std::size_t> tail; // prossima posizione da scrivere (scritta dal produttore)
+	char pad2[64];
+};
+
+
+// SpscQueue con attesa bloccante per gli stadi della pipeline: push/pop provano prima la coda
+// lock-free e solo se e' piena/vuota il thread si addormenta sulla condition_variable, invece
+// di girare a vuoto su un core. Chi inserisce o estrae prende il mutex solo se qualcuno aspetta.
+// close sveglia tutti: da quel momento push/pop ritornano false quando dovrebbero aspettare.
+template <typename T>
+class BlockingSpscQueue {
+public:
+	explicit BlockingSpscQueue(std::size_t capacity) : queue(capacity), waiters(0), closed(false) {}
+
+	// solo dal thread produttore; false se la coda e' piena e chiusa
+	bool push(const T& value){
+		if(!queue.tryPush(value)){
+			std::unique_lock<std::mutex> lk(m);
+			++waiters;
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			while(!queue.tryPush(value)){
+				if(closed){
+					--waiters;
+					return false;
+				}
+				cv.wait(lk);
+			}
+			--waiters;
+		}
+		wakeWaiters();
+		return true;
+	}
+
+	// solo dal thread consumatore; false se la coda e' vuota e chiusa
+	bool pop(T& value){
+		if(!queue.tryPop(value)){
+			std::unique_lock<std::mutex> lk(m);
+			++waiters;
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			while(!queue.tryPop(value)){
+				if(closed){
+					--waiters;
+					return false;
+				}
+				cv.wait(lk);
+			}
+			--waiters;
+		}
+		wakeWaiters();
+		return true;
+	}
+
+	// come SpscQueue, senza attese
+	bool tryPop(T& value){
+		if(!queue.tryPop(value))
+			return false;
+		wakeWaiters();
+		return true;
+	}
+
+	// sveglia chi aspetta; le push/pop che dovrebbero aspettare ritornano false
+	void close(){
+		std::lock_guard<std::mutex> lk(m);
+		closed = true;
+		cv.notify_all();
+	}
+
+private:
+	BlockingSpscQueue(const BlockingSpscQueue&);
+	BlockingSpscQueue& operator=(const BlockingSpscQueue&);
+
+	// dopo una push/pop riuscita: se l'altro thread aspetta (posto libero o elemento nuovo) lo sveglio.
+	// La fence con quella di chi si mette in attesa garantisce che almeno uno dei due veda l'altro.
+	void wakeWaiters(){
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if(waiters.load(std::memory_order_relaxed) != 0){
+			std::lock_guard<std::mutex> lk(m);
+			cv.notify_all();
+		}
+	}
+
+	SpscQueue<T> queue;
+	std::mutex m;
+	std::condition_variable cv;
+	std::atomic<int> waiters; // thread in attesa (al massimo produttore e consumatore)
+	bool closed; // protetto da m
+};
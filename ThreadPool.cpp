@@ -0,0 +1,132 @@
+//C
+#include <assert.h>
+//C++
+#include <algorithm>
+
+#include "ThreadPool.h"
+
+using namespace std;
+
+ThreadPool::ThreadPool(unsigned int nThreads):
+	stop(false), generation(0), busy(0), nextChunk(0), pendingChunks(0)
+{
+	if(nThreads == 0)
+		nThreads = max(1u, thread::hardware_concurrency());
+	// il thread chiamante conta come uno dei thread
+	for(unsigned int i=1; i<nThreads; ++i)
+		workers.push_back(thread(&ThreadPool::workerLoop, this));
+}
+
+ThreadPool::~ThreadPool(){
+	{
+		lock_guard<mutex> lk(m);
+		stop = true;
+	}
+	wakeCv.notify_all();
+	for(size_t i=0; i<workers.size(); ++i)
+		workers[i].join();
+}
+
+unsigned int ThreadPool::size() const {
+	return (unsigned int)workers.size() + 1;
+}
+
+unsigned int ThreadPool::threadIndex() const {
+	thread::id self = this_thread::get_id();
+	for(size_t i=0; i<workers.size(); ++i)
+		if(workers[i].get_id() == self)
+			return (unsigned int)i + 1;
+	return 0;
+}
+
+bool ThreadPool::isInsideParallelFor(){
+	thread::id self = this_thread::get_id();
+	for(size_t i=0; i<workers.size(); ++i)
+		if(workers[i].get_id() == self)
+			return true;
+	lock_guard<mutex> lk(m);
+	return job.body != 0 && caller == self;
+}
+
+void ThreadPool::parallelFor(size_t n, const function<void(size_t, size_t)>& body, size_t grain){
+	if(n == 0)
+		return;
+	if(grain == 0)
+		grain = (n + size() - 1) / size();
+	size_t chunks = (n + grain - 1) / grain;
+
+	// niente da dividere: lo eseguo direttamente
+	if(workers.empty() || chunks == 1){
+		body(0, n);
+		return;
+	}
+
+	// una parallelFor dentro body si bloccherebbe su callMutex
+	assert(!isInsideParallelFor());
+
+	Job current;
+	current.body = &body;
+	current.n = n;
+	current.grain = grain;
+	current.chunks = chunks;
+
+	lock_guard<mutex> call(callMutex);
+	{
+		lock_guard<mutex> lk(m);
+		job = current;
+		caller = this_thread::get_id();
+		nextChunk = 0;
+		pendingChunks = chunks;
+		++generation;
+	}
+	wakeCv.notify_all();
+
+	runChunks(current);
+
+	// aspetto anche i worker che hanno preso il lavoro senza trovare blocchi liberi;
+	// dopo il reset di job un worker in ritardo non trova piu' niente da fare
+	unique_lock<mutex> lk(m);
+	while(pendingChunks != 0 || busy != 0)
+		doneCv.wait(lk);
+	job = Job();
+	caller = thread::id();
+}
+
+void ThreadPool::runChunks(const Job& job){
+	for(;;){
+		size_t c = nextChunk++;
+		if(c >= job.chunks)
+			break;
+		size_t begin = c * job.grain;
+		(*job.body)(begin, min(job.n, begin + job.grain));
+		if(--pendingChunks == 0){
+			lock_guard<mutex> lk(m);
+			doneCv.notify_all();
+		}
+	}
+}
+
+void ThreadPool::workerLoop(){
+	unique_lock<mutex> lk(m);
+	unsigned long seen = generation;
+	for(;;){
+		while(!stop && generation == seen)
+			wakeCv.wait(lk);
+		if(stop)
+			return;
+		seen = generation;
+		// svegliato in ritardo: la parallelFor e' gia' finita
+		if(!job.body)
+			continue;
+		// copia del lavoro presa insieme a busy: finche' busy > 0 la parallelFor non ritorna,
+		// quindi body resta valido e nextChunk non viene azzerato da quella successiva
+		Job current = job;
+		++busy;
+		lk.unlock();
+		runChunks(current);
+		lk.lock();
+		--busy;
+		if(busy == 0)
+			doneCv.notify_all();
+	}
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+//C++
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <memory>
+
+
+// Pool di thread fissi per i cicli paralleli (es: tutti i modelli della banca su un frame).
+// parallelFor divide [0,n) in blocchi di "grain" indici e li distribuisce tra i worker;
+// anche il thread chiamante lavora e al ritorno tutti i blocchi sono terminati.
+// Le chiamate a parallelFor da thread diversi vengono eseguite una alla volta.
+// parallelFor non si puo' annidare: body non deve chiamare parallelFor sullo stesso pool
+// (si bloccherebbe su callMutex; nelle build di debug c'e' un assert).
+class ThreadPool {
+public:
+	// nThreads = 0 -> un thread per core (hardware_concurrency), 1 -> tutto sul thread chiamante
+	explicit ThreadPool(unsigned int nThreads = 0);
+	~ThreadPool();
+
+	// numero di thread che eseguono i blocchi (worker + chiamante)
+	unsigned int size() const;
+
+	// indice del thread corrente in [0, size()): 1..size()-1 per i worker, 0 per tutti gli altri
+	// (quindi per il chiamante di parallelFor). Dentro body serve per i dati per thread,
+	// es: un accumulatore per thread invece di un mutex sui risultati.
+	unsigned int threadIndex() const;
+
+	// body(begin, end) viene chiamata su intervalli disgiunti che coprono [0,n).
+	// grain = 0 -> un blocco per thread
+	void parallelFor(std::size_t n, const std::function<void(std::size_t, std::size_t)>& body, std::size_t grain = 0);
+
+private:
+	ThreadPool(const ThreadPool&);
+	ThreadPool& operator=(const ThreadPool&);
+
+	// lavoro di una parallelFor: ogni thread ne legge una copia presa sotto il mutex
+	struct Job {
+		const std::function<void(std::size_t, std::size_t)>* body;
+		std::size_t n;
+		std::size_t grain;
+		std::size_t chunks;
+		Job() : body(0), n(0), grain(1), chunks(0) {}
+	};
+
+	void workerLoop();
+	void runChunks(const Job& job);
+	// true se il thread corrente sta gia' eseguendo una parallelFor di questo pool
+	bool isInsideParallelFor();
+
+	std::vector<std::thread> workers;
+	std::mutex callMutex; // una parallelFor alla volta
+	std::mutex m;
+	std::condition_variable wakeCv; // nuovo lavoro (o stop)
+	std::condition_variable doneCv; // lavoro finito
+	bool stop;
+	unsigned long generation; // incrementato ad ogni parallelFor
+	unsigned int busy; // worker dentro runChunks
+
+	// lavoro corrente (scritto e letto solo sotto m; job.body == 0 quando non c'e' lavoro)
+	Job job;
+	std::thread::id caller; // thread che sta eseguendo la parallelFor corrente
+	std::atomic<std::size_t> nextChunk;
+	std::atomic<std::size_t> pendingChunks;
+};
+
+typedef std::shared_ptr<ThreadPool> ThreadPoolPtr;
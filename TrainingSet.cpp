@@ -0,0 +1,97 @@
+//C++
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+
+#include "TrainingSet.h"
+#include "dirent.h"
+
+using namespace std;
+
+TrainingSetReader::TrainingSetReader(const string& dirPath, unsigned int size) :
+	path(dirPath), featureSize(size), nextFile(0), nextSequence(0) {}
+
+// true se name finisce con ext
+static bool hasExtension(const string& name, const string& ext){
+	return name.size() > ext.size() && name.compare(name.size()-ext.size(), ext.size(), ext) == 0;
+}
+
+bool TrainingSetReader::Rewind(){
+	files.clear();
+	nextFile = 0;
+	store = FeatureStoreReader();
+	nextSequence = 0;
+
+	DIR* d = opendir(path.c_str());
+	if(!d){
+		cout << "Errore apertura cartella di training " << path << endl;
+		return false;
+	}
+	dirent* f;
+	while((f = readdir(d))){
+		string tmp = f->d_name;
+		if(hasExtension(tmp, ".feat") || hasExtension(tmp, ".txt"))
+			files.push_back(tmp);
+	}
+	closedir(d);
+	// stesso ordine ad ogni passata (e su ogni sistema)
+	sort(files.begin(), files.end());
+	return true;
+}
+
+bool TrainingSetReader::Next(vector<vector<double> >& seq){
+	if(!featureSize)
+		return false;
+	while(true){
+		// prima le sequenze rimaste nel file .feat corrente
+		if(nextSequence < store.sequences()){
+			store.getSequence(nextSequence++, seq);
+			return true;
+		}
+		if(nextFile >= files.size())
+			return false;
+		const string& name = files[nextFile++];
+		nextSequence = 0;
+		if(hasExtension(name, ".feat")){
+			if(!store.open(path + name))
+				cout << "Errore apertura " << path << name << endl;
+			else if(store.dimension() != featureSize){
+				cout << path << name << ": feature di dimensione " << store.dimension() << " invece di " << featureSize << endl;
+				nextSequence = store.sequences();
+			}
+		}
+		else{
+			store = FeatureStoreReader();
+			if(readText(path + name, seq))
+				return true;
+		}
+	}
+}
+
+bool TrainingSetReader::readText(const string& fileName, vector<vector<double> >& seq){
+	ifstream in(fileName);
+	if(!in){
+		cout << "Errore apertura " << fileName << endl;
+		return false;
+	}
+	// i frame gia' presenti in seq vengono sovrascritti, senza riallocare
+	size_t t = 0;
+	unsigned int r = 0;
+	double val;
+	while(in >> val){
+		if(t == seq.size())
+			seq.push_back(vector<double>());
+		seq[t].resize(featureSize);
+		seq[t][r] = val;
+		if(++r == featureSize){
+			r = 0;
+			++t;
+		}
+	}
+	seq.resize(t);
+	return t != 0;
+}
+
+size_t TrainingSetReader::size() const {
+	return files.size();
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+//C++
+#include <string>
+#include <vector>
+
+#include "gmmstd_hmm_GMM.h"
+#include "FeatureStore.h"
+
+
+// Training set di una categoria letto dalla sua cartella (es: training\<categoria>\):
+//  - <video>.feat: feature store binario (FeatureStore.h), mappato in memoria, una o piu'
+//    sequenze per file
+//  - <video>.txt: vecchio formato testo, un valore per riga e featureSize valori per frame,
+//    una sequenza per file
+// Con BaumWelch_Stream i file vengono riletti ad ogni iterazione e in memoria c'e' solo
+// il blocco di sequenze in elaborazione.
+class TrainingSetReader : public gmmstd::CSequenceReader {
+public:
+	// dirPath: cartella della categoria, con il separatore finale (es: "training\\walk\\")
+	TrainingSetReader(const std::string& dirPath, unsigned int featureSize);
+
+	// rilegge l'elenco dei file e riparte dal primo; false se la cartella non si apre
+	bool Rewind();
+	// legge la prossima sequenza; i file vuoti, che non si aprono o con feature di un'altra
+	// dimensione vengono saltati e un eventuale ultimo frame incompleto viene scartato
+	bool Next(std::vector<std::vector<double> >& seq);
+
+	// numero di file trovati dall'ultimo Rewind
+	std::size_t size() const;
+
+private:
+	// legge un file .txt; false se non ha frame
+	bool readText(const std::string& fileName, std::vector<std::vector<double> >& seq);
+
+	std::string path;
+	unsigned int featureSize;
+	std::vector<std::string> files;
+	std::size_t nextFile;
+	FeatureStoreReader store; // file .feat corrente
+	std::size_t nextSequence; // prossima sequenza di store
+};
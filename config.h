@@ -2,10 +2,16 @@
 
 const bool processALL = false;
 const int waitTimeSpan = 1;
+const bool headless = false; //TRUE: nessuna finestra e nessun waitKey (anche con -headless da riga di comando)
 const double learningRate = 0.06;
 const bool test = true; //da settare: TRUE se si vuole testare, FALSE se si vogliono creare i file di train
+const bool featureStoreFloat = false; //file di train (training\<categoria>\<video>.feat) in float invece che in double: meta' spazio
 
 const int lk_thresh = 0; //livello di sicurezza minimo per dare in output la classificazione
 const int windowSize = 30;
 const int windowNum = 4;
-const int windowsStep = 5;
\ No newline at end of file
+const int windowsStep = 5;
+const int scoringThreads = 0; //thread per valutare i modelli in parallelo (0 = uno per core, 1 = nessun thread aggiuntivo)
+const int datasetThreads = 0; //video elaborati contemporaneamente in modalita' processALL (0 = uno per core)
+const char hmmBankFile[] = "hmm.bank"; //file binario con tutti gli HMM (creato da hmm/ se manca, ricostruito da solo se i file di hmm/ cambiano)
+const int pipelineQueueSize = 8; //frame in attesa tra due stadi consecutivi della pipeline di FrameAnalyzer
\ No newline at end of file
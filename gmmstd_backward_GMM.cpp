@@ -10,9 +10,68 @@
 */
 
 #include <stdio.h>
+#include <algorithm>
+#include <limits>
 #include "gmmstd_hmm_gmm.h"
+#include "gmmstd_gmm_simd.h"
 namespace gmmstd{
 static char rcsid[] = "$Id: backward.c,v 1.3 1998/02/23 07:56:05 kanungo Exp kanungo $";
 
+
+// logBeta(t,i) = log sum_j A(i,j) exp(logB(t+1,j) + logBeta(t+1,j))
+// come ForwardLog: v_j = logB(t+1,j) + logBeta(t+1,j) scalati sul massimo, poi
+// una riga di A per ogni stato di arrivo
+double CHMM_GMM::BackwardLog(const Mat_<double> &logB, Mat_<double> &logBeta, double *work)
+{
+	unsigned int	i, j;	/* state indices */
+	int	t;	/* time index */
+
+	unsigned int T=logB.rows;
+	if (!T)
+		return 0;  // errore
+
+	if (logBeta.rows!=T || logBeta.cols!=m_iN)
+		logBeta.create(T,m_iN);
+
+	const double dMinusInf = -numeric_limits<double>::infinity();
+	vector<double> local;
+	if (!work){
+		local.resize(3*m_iN);
+		work = &local[0];
+	}
+	double *v = work;
+	double *w = work + m_iN;
+
+	/* 1. Initialization */
+	for (i = 0; i < m_iN; i++)
+		logBeta(T-1,i) = 0;
+
+	/* 2. Induction */
+	for (t = (int)T-2; t >= 0; --t){
+		for (j = 0; j < m_iN; j++)
+			v[j] = logB(t+1,j) + logBeta(t+1,j);
+		double dMax = *max_element(v, v+m_iN);
+		if (dMax == dMinusInf){
+			for (i = 0; i < m_iN; i++)
+				logBeta(t,i) = dMinusInf;
+			continue;
+		}
+
+		ExpShifted(v, m_iN, dMax, w);
+		for (i = 0; i < m_iN; i++){
+			const double *a = &m_A(i,0);
+			double sum = 0.0;
+			for (j = 0; j < m_iN; j++)
+				sum += a[j] * w[j];
+			logBeta(t,i) = dMax + log(sum);
+		}
+	}
+
+	/* 3. Termination: log P = log sum_i pi_i b_i(O_0) beta(0,i) */
+	for (i = 0; i < m_iN; i++)
+		v[i] = log(m_pi(i,0)) + logB(0,i) + logBeta(0,i);
+	return LogSumExp(v, m_iN, w);
+}
+
 	
 	} // namespace
\ No newline at end of file
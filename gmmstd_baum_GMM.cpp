@@ -17,7 +17,10 @@
 
 #include <stdio.h> 
 #include "gmmstd_hmm_gmm.h"
+#include "gmmstd_gmm_simd.h"
 #include <math.h>
+#include <algorithm>
+#include <limits>
 
 namespace gmmstd{
 static char rcsid[] = "$Id: baumwelch.c,v 1.6 1999/04/24 15:58:43 kanungo Exp kanungo $";
@@ -56,4 +59,361 @@ void CHMM_GMM::ComputeGamma(Mat_<double> &alpha, Mat_<double> &beta, Mat_<double
 }
 
 	
+// ComputeXi con le emissioni gia' calcolate: logB(t,j) = log b_j(O_t)
+void CHMM_GMM::ComputeXi(const Mat_<double> &logB, Mat_<double> &alpha, Mat_<double> &beta, Mat_<double> &xi)
+{
+	unsigned int i, j;
+	unsigned  int t;
+	double sum;
+	double dBjO;
+
+	unsigned int T;
+		T= logB.rows;
+
+	for (t = 0; t < T - 1; t++) {
+		sum = 0.0;	
+		for (i = 0; i < m_iN; i++) 
+			for (j = 0; j < m_iN; j++) {
+				dBjO = exp(logB(t+1,j));
+				xi(t,i,j) = alpha(t,i)*beta(t+1,j)
+					*(m_A(i,j))
+					*dBjO;
+				sum += xi(t,i,j);
+			}
+
+		assert (sum);
+		
+		for (i = 0; i < m_iN; i++) 
+			for (j = 0; j < m_iN; j++) 
+				xi(t,i,j)  /= sum;
+	}
+}
+
+	
+	// gamma(t,j) = alpha(t,j) beta(t,j) / sum_i alpha(t,i) beta(t,i), calcolato in log
+void CHMM_GMM::ComputeGammaLog(const Mat_<double> &logAlpha, const Mat_<double> &logBeta, Mat_<double> &gamma, double *work)
+{
+	unsigned int j;
+	unsigned int t;
+	unsigned int T = logAlpha.rows;
+
+	vector<double> local;
+	if (!work){
+		local.resize(3*m_iN);
+		work = &local[0];
+	}
+	double *v = work;
+	double *w = work + m_iN;
+	const double dMinusInf = -numeric_limits<double>::infinity();
+
+	for (t = 0; t < T; t++) {
+		for (j = 0; j < m_iN; j++)
+			v[j] = logAlpha(t,j) + logBeta(t,j);
+		double dMax = *max_element(v, v+m_iN);
+		// sequenza impossibile per il modello (come in ForwardLog/BackwardLog): il frame
+		// non contribuisce alle statistiche invece di riempirle di NaN (-inf - -inf)
+		if (dMax == dMinusInf){
+			for (j = 0; j < m_iN; j++)
+				gamma(t,j) = 0.;
+			continue;
+		}
+		ExpShifted(v, m_iN, dMax, w);
+
+		// il massimo contribuisce con exp(0)=1: il denominatore non va mai in underflow
+		double denominator = 0.0;
+		for (j = 0; j < m_iN; j++)
+			denominator += w[j];
+		for (j = 0; j < m_iN; j++)
+			gamma(t,j) = (denominator > 0) ? w[j] / denominator : 0.;
+	}
+}
+
+
+// xi(t,i,j) proporzionale a alpha(t,i) A(i,j) b_j(O_t+1) beta(t+1,j): i due fattori in log
+// sono scalati ognuno sul proprio massimo, quindi 2N exp per osservazione invece di N^2
+void CHMM_GMM::ComputeXiLog(const Mat_<double> &logB, const Mat_<double> &logAlpha, const Mat_<double> &logBeta, Mat_<double> &xi, double *work)
+{
+	unsigned int i, j;
+	unsigned int t;
+	double sum;
+
+	unsigned int T = logB.rows;
+
+	vector<double> local;
+	if (!work){
+		local.resize(3*m_iN);
+		work = &local[0];
+	}
+	double *v = work;
+	double *wa = work + m_iN;
+	double *wb = work + 2*m_iN;
+	const double dMinusInf = -numeric_limits<double>::infinity();
+
+	for (t = 0; t + 1 < T; t++) {
+		const double *la = &logAlpha(t,0);
+		const double dMaxA = *max_element(la, la+m_iN);
+		for (j = 0; j < m_iN; j++)
+			v[j] = logB(t+1,j) + logBeta(t+1,j);
+		const double dMaxB = *max_element(v, v+m_iN);
+
+		sum = 0.0;
+		if (dMaxA != dMinusInf && dMaxB != dMinusInf){
+			ExpShifted(la, m_iN, dMaxA, wa);
+			ExpShifted(v, m_iN, dMaxB, wb);
+			for (i = 0; i < m_iN; i++)
+				for (j = 0; j < m_iN; j++) {
+					xi(t,i,j) = wa[i] * m_A(i,j) * wb[j];
+					sum += xi(t,i,j);
+				}
+		}
+
+		// transizione impossibile (tutti gli stati a -inf o A nulla dove servirebbe): xi a zero
+		if (!(sum > 0)){
+			for (i = 0; i < m_iN; i++)
+				for (j = 0; j < m_iN; j++)
+					xi(t,i,j) = 0.;
+			continue;
+		}
+
+		for (i = 0; i < m_iN; i++) 
+			for (j = 0; j < m_iN; j++) 
+				xi(t,i,j) /= sum;
+	}
+}
+
+	
+	void CBaumWelchStats::Reset(unsigned int N, unsigned int K, unsigned int M, bool bDiagonal)
+{
+	m_iN = N;
+	m_iK = K;
+	m_iM = M;
+	m_bDiagonal = bDiagonal;
+	m_dLogProb = 0;
+	m_pi.assign(N, 0.);
+	m_gamma.assign(N, 0.);
+	m_xi.assign(N*N, 0.);
+	m_occ.assign(N*K, 0.);
+	m_sum.assign(N*K*M, 0.);
+	m_sumSq.assign(N*K*SecondOrderSize(), 0.);
+}
+
+
+void CBaumWelchStats::Add(const CBaumWelchStats &other)
+{
+	assert(other.m_iN == m_iN && other.m_iK == m_iK && other.m_iM == m_iM && other.m_bDiagonal == m_bDiagonal);
+	m_dLogProb += other.m_dLogProb;
+	size_t i;
+	for (i = 0; i < m_iN; i++){
+		m_pi[i] += other.m_pi[i];
+		m_gamma[i] += other.m_gamma[i];
+	}
+	for (i = 0; i < m_xi.size(); i++)
+		m_xi[i] += other.m_xi[i];
+	for (i = 0; i < m_occ.size(); i++)
+		m_occ[i] += other.m_occ[i];
+	for (i = 0; i < m_sum.size(); i++)
+		m_sum[i] += other.m_sum[i];
+	for (i = 0; i < m_sumSq.size(); i++)
+		m_sumSq[i] += other.m_sumSq[i];
+}
+
+
+void CBaumWelchWorkspace::Reserve(unsigned int T, unsigned int N, unsigned int K, unsigned int M)
+{
+	if (T <= m_iT && N == m_iN && K == m_iK && M == m_iM)
+		return;
+	// stesso modello: cresce soltanto, cosi' si rialloca al piu' una volta per ogni nuova lunghezza massima
+	if (N == m_iN && K == m_iK && M == m_iM)
+		T = max(T, m_iT);
+	m_iT = T;
+	m_iN = N;
+	m_iK = K;
+	m_iM = M;
+
+	m_obs.create(T, M);
+	m_logLK.resize(N);
+	for (unsigned int j = 0; j < N; j++)
+		m_logLK[j].create(T, K);
+	m_logB.create(T, N);
+	m_logAlpha.create(T, N);
+	m_logBeta.create(T, N);
+	m_gamma.create(T, N);
+	int iSize[] = {(int)T, (int)N, (int)N};
+	m_xi = Mat_<double>(3, iSize);
+	m_work.resize(max(K, 3*N));
+}
+
+
+void CBaumWelchWorkspace::PackStates(vector<CGMM_tiny> &states)
+{
+	m_packed.resize(states.size());
+	m_bPacked = true;
+	for (size_t j = 0; j < states.size(); j++)
+		if (!m_packed[j].Pack(states[j]))
+			m_bPacked = false;
+}
+
+
+ThreadPool &CHMM_GMM::GetTrainingPool(std::unique_ptr<ThreadPool> &ownPool) const
+{
+	if (m_pTrainingPool)
+		return *m_pTrainingPool;
+	// un pool per tutto il training: i thread non vengono ricreati ad ogni E-step
+	ownPool.reset(new ThreadPool(m_iTrainingThreads));
+	return *ownPool;
+}
+
+
+bool CHMM_GMM::BaumWelch_Stream(CSequenceReader &reader, unsigned int nSequences, int *pniter, double *plogprobinit, double *plogprobfinal)
+{
+	unsigned int l = 0;
+	unsigned int E = 0;
+	double delta, logprobprev;
+
+	// INIT - calcolo valori iniziali
+	CBaumWelchStats stats;
+	vector<CBaumWelchWorkspace> workspaces;
+	std::unique_ptr<ThreadPool> ownPool;
+	ThreadPool &pool = GetTrainingPool(ownPool);
+	if (!EStep_Stream(reader, nSequences, stats, E, workspaces, pool) || !E)
+		return false;
+	*plogprobinit = stats.m_dLogProb;
+
+	logprobprev = *plogprobinit;
+
+	// ITERAZIONI FINO A CONVERGENZA 
+	do  {	
+		MStep(stats, E);
+
+		if (!EStep_Stream(reader, nSequences, stats, E, workspaces, pool) || !E)
+			return false;
+
+		delta = fabs(stats.m_dLogProb - logprobprev); 
+		logprobprev = stats.m_dLogProb;
+		l++;
+	}
+	while (delta > DELTA);
+
+	*pniter = l;
+	*plogprobfinal = logprobprev;
+	return true;
+}
+
+
+bool CHMM_GMM::EStep_Stream(CSequenceReader &reader, unsigned int nSequences, CBaumWelchStats &stats, unsigned int &E, vector<CBaumWelchWorkspace> &workspaces, ThreadPool &pool)
+{
+	stats.Reset(m_iN, m_iK, m_iM, m_bDiagonalCovariance);
+	E = 0;
+	if (!reader.Rewind())
+		return false;
+	if (!nSequences)
+		nSequences = 1;
+
+	// durata delle sequenze, per la probabilita' della lunghezza
+	double dSumOfT = 0, dSumofSquareT = 0;
+
+	// il blocco viene riusato: le sequenze lette dopo riusano la memoria delle precedenti
+	vector<vector<vector<double> > > chunk (nSequences);
+	CBaumWelchStats chunkStats;
+	bool bEnd = false;
+	bool bFirstChunk = true; // i parametri cambiano solo tra una passata e l'altra
+	while (!bEnd){
+		unsigned int n = 0;
+		while (n < nSequences && !(bEnd = !reader.Next(chunk[n]))){
+			double T = (double)chunk[n].size();
+			dSumOfT += T;
+			dSumofSquareT += T*T;
+			n++;
+		}
+		if (!n)
+			break;
+		EStep_Multiple(chunk.begin(), chunk.begin()+n, chunkStats, workspaces, pool, bFirstChunk);
+		bFirstChunk = false;
+		stats.Add(chunkStats);
+		E += n;
+	}
+
+	if (E){
+		m_dDurationMean = dSumOfT / E;
+		m_dDurationVariance = (dSumofSquareT / E) - (m_dDurationMean *m_dDurationMean);
+	}
+	return true;
+}
+
+
+void CHMM_GMM::MStep(const CBaumWelchStats &stats, unsigned int E)
+{
+	unsigned int i, j, k, r, s;
+	const unsigned int M = m_iM;
+	const unsigned int S = stats.SecondOrderSize();
+
+	// reestimate frequency of state i in time t=1 
+	for (i = 0; i < m_iN; i++)
+		m_pi(i,0) = stats.m_pi[i] / E;
+
+	for (i = 0; i < m_iN; i++) { 
+
+		// aggiorno Aij
+		double denominatorA = stats.m_gamma[i];
+		double dSum=0;
+		for (j = 0; j < m_iN; j++) {
+			if (denominatorA)
+				m_A(i,j) = stats.m_xi[i*m_iN+j]/denominatorA;
+			else
+				m_A(i,j) =0;
+			dSum+=m_A(i,j);
+		}
+
+		// rinormalizzo A affinche' sia stocastica
+		assert(fabs(dSum-1)<.001);
+		if (fabs(dSum-1)>.001)
+			for (j = 0; j < m_iN; j++)
+				m_A(i,j) /= dSum;
+
+		// occupazione dello stato su tutti i t (anche l'ultimo di ogni sequenza): i pesi sommano a 1
+		double dOcc = 0;
+		for (k = 0; k < m_iK; k++)
+			dOcc += stats.m_occ[stats.Component(i,k)];
+
+		for (k = 0; k < m_iK; k++){
+			const unsigned int c = stats.Component(i,k);
+			const double occ = stats.m_occ[c];
+			// gaussiana mai usata: peso nullo, media e covarianza restano quelle di prima
+			if (occ <= 0 || dOcc <= 0){
+				m_B[i].WeightValue(k) = 0;
+				continue;
+			}
+			m_B[i].WeightValue(k) = occ / dOcc;
+
+			//muil
+			const double *s1 = &stats.m_sum[c*M];
+			for (r = 0; r < M; r++)
+				m_B[i].MeanValue(k,r) = s1[r] / occ;
+
+			//sigmail = E[x x'] - mu mu', con le stesse soglie di prima
+			const double *s2 = &stats.m_sumSq[c*S];
+			for (r = 0; r < M; r++){
+				const double mur = m_B[i].MeanValue(k,r);
+				for (s = r; s < M; s++){
+					double dVal;
+					if (r == s){
+						dVal = (stats.m_bDiagonal ? s2[r] : s2[r*M+r]) / occ - mur*mur;
+						m_B[i].CoVarianceValue(k,r,r) = (dVal <= DELTA) ? DELTA : dVal;
+					}
+					else{
+						dVal = stats.m_bDiagonal ? 0 : s2[r*M+s] / occ - mur*m_B[i].MeanValue(k,s);
+						if ((dVal <= DELTA) || (m_bDiagonalCovariance))
+							dVal = 0;
+						m_B[i].CoVarianceValue(k,r,s) = dVal;
+						m_B[i].CoVarianceValue(k,s,r) = dVal;
+					}
+				}
+			}
+			// ricalcolo le inverse
+			m_B[i].GetGaussian(k).InverseRecalc();
+		}
+	}
+}
+
+	
 	} // namespace
\ No newline at end of file
@@ -9,7 +9,162 @@
 **      $Id: forward.c,v 1.2 1998/02/19 12:42:31 kanungo Exp kanungo $
 */
 #include <stdio.h>
+#include <algorithm>
+#include <limits>
 #include "gmmstd_hmm_gmm.h"
+#include "gmmstd_gmm_simd.h"
 
 
-// sono rimasti solo dei template
\ No newline at end of file
+// sono rimasti solo dei template (piu' la forward incrementale, che non lo e')
+
+namespace gmmstd{
+
+void CHMM_GMM::ForwardReset(CForwardState &state) const
+{
+	state.m_iT = 0;
+	state.m_dLogProb = 0;
+	state.m_logAlpha.assign(m_iN, 0.);
+	state.m_logAlphaNext.assign(m_iN, 0.);
+	state.m_work.assign(m_iN, 0.);
+}
+
+
+// un passo della ForwardLog: O(N^2) per osservazione invece di O(T*N^2) per sequenza
+double CHMM_GMM::ForwardStep(CForwardState &state, const vector<double> &observation)
+{
+	vector<double> logB (m_iN);
+	ComputeLogEmissions(observation, &logB[0]);
+	return ForwardStep(state, &logB[0]);
+}
+
+
+double CHMM_GMM::ForwardStep(CForwardState &state, const double *logB) const
+{
+	if (state.m_logAlpha.size() != m_iN)
+		ForwardReset(state);
+	return ForwardStepLog(state, m_iN, &m_pi(0,0), &m_A(0,0), (int)(m_A.step[0]/sizeof(double)), logB);
+}
+
+
+double ForwardStepLog(CForwardState &state, unsigned int N, const double *pi, const double *A, int iAStep, const double *logB)
+{
+	unsigned int	i, j; 	/* state indices */
+	const double dMinusInf = -numeric_limits<double>::infinity();
+
+	if (state.m_logAlpha.size() != N || state.m_work.size() != N){
+		state.m_iT = 0;
+		state.m_dLogProb = 0;
+		state.m_logAlpha.assign(N, 0.);
+		state.m_logAlphaNext.assign(N, 0.);
+		state.m_work.assign(N, 0.);
+	}
+
+	const double *prev = &state.m_logAlpha[0];
+	double *next = &state.m_logAlphaNext[0];
+	double *w = &state.m_work[0];
+
+	if (state.m_iT == 0){
+		/* 1. Initialization */
+		for (i = 0; i < N; i++)
+			next[i] = log(pi[i]) + logB[i];
+	}
+	else if (state.m_dLogProb == dMinusInf){
+		// sequenza gia' impossibile per il modello: resta tale
+		fill(next, next+N, dMinusInf);
+	}
+	else{
+		/* 2. Induction: next(j) = logB(j) + log sum_i exp(prev(i)) A(i,j) */
+		double dMax = *max_element(prev, prev+N);
+		ExpShifted(prev, N, dMax, w);
+		fill(next, next+N, 0.);
+		for (i = 0; i < N; i++){ // per ogni stato di partenza: riga di A contigua
+			const double wi = w[i];
+			const double *a = A + i*iAStep;
+			for (j = 0; j < N; j++)
+				next[j] += wi * a[j];
+		}
+		for (j = 0; j < N; j++)
+			next[j] = logB[j] + dMax + log(next[j]);
+	}
+
+	// normalizzazione: log P(O_t | O_0..O_t-1) = log sum_j alpha(t,j)
+	double dLogScale = LogSumExp(next, N, w);
+	if (dLogScale == dMinusInf)
+		state.m_dLogProb = dMinusInf;
+	else{
+		for (j = 0; j < N; j++)
+			next[j] -= dLogScale;
+		state.m_dLogProb += dLogScale;
+	}
+
+	state.m_logAlpha.swap(state.m_logAlphaNext);
+	state.m_iT++;
+
+	return state.m_dLogProb;
+}
+
+
+// logAlpha(t,j) = logB(t,j) + log sum_i exp(logAlpha(t-1,i)) A(i,j)
+// la log-sum-exp e' fatta scalando sul massimo degli stati di partenza:
+// w_i = exp(logAlpha(t-1,i) - max), sum_j = sum_i w_i A(i,j), logAlpha(t,j) = logB(t,j) + max + log(sum_j)
+double CHMM_GMM::ForwardLog(const Mat_<double> &logB, Mat_<double> &logAlpha, double *work)
+{
+	unsigned int	i, j; 	/* state indices */
+	unsigned int	t;	/* time index */
+
+	unsigned int T=logB.rows;
+	if (!T)
+		return 0;  // errore
+
+	if (logAlpha.rows!=T || logAlpha.cols!=m_iN)
+		logAlpha.create(T,m_iN);
+
+	const double dMinusInf = -numeric_limits<double>::infinity();
+	vector<double> local;
+	if (!work){
+		local.resize(3*m_iN);
+		work = &local[0];
+	}
+	double *w = work;
+	double *sum = work + m_iN;
+
+	/* 1. Initialization */
+	for (i = 0; i < m_iN; i++)
+		logAlpha(0,i) = log(m_pi(i,0)) + logB(0,i);
+
+	/* 2. Induction */
+	for (t = 1; t < T; t++){
+		const double *prev = &logAlpha(t-1,0);
+		double dMax = *max_element(prev, prev+m_iN);
+		if (dMax == dMinusInf){
+			// sequenza impossibile per il modello
+			for (j = 0; j < m_iN; j++)
+				logAlpha(t,j) = dMinusInf;
+			continue;
+		}
+
+		ExpShifted(prev, m_iN, dMax, w);
+		fill(sum, sum+m_iN, 0.);
+		for (i = 0; i < m_iN; i++){ // per ogni stato di partenza: riga di A contigua
+			const double wi = w[i];
+			const double *a = &m_A(i,0);
+			for (j = 0; j < m_iN; j++)
+				sum[j] += wi * a[j];
+		}
+		for (j = 0; j < m_iN; j++)
+			logAlpha(t,j) = logB(t,j) + dMax + log(sum[j]);
+	}
+
+	/* 3. Termination: log P = log sum_i alpha(T-1,i) */
+	return LogSumExp(&logAlpha(T-1,0), m_iN, w);
+}
+
+
+// emissioni di una sola osservazione per tutti gli stati
+void CHMM_GMM::ComputeLogEmissions(const vector<double> &observation, double *logB, bool bRecalc)
+{
+	for (unsigned int j = 0; j < m_iN; j++)
+		logB[j] = m_B[j].GetLogLikelihood_exact(observation, bRecalc);
+}
+
+	} // namespace
\ No newline at end of file
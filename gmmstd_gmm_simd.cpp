@@ -0,0 +1,369 @@
+//------------------------------------------------------------------
+//
+// Nome file: gmm_simd.cpp
+// Contenuto: log-likelihood di GMM diagonali su blocchi di osservazioni
+//            (kernel vettoriali AVX2/SSE2, double e float)
+//
+//------------------------------------------------------------------
+
+
+#include "gmmstd_gmm_simd.h"
+
+#include <math.h>
+#include <float.h>
+#include <assert.h>
+#include <limits>
+
+#if defined(GMMSTD_SIMD_AVX2)
+	#include <immintrin.h>
+#elif defined(GMMSTD_SIMD_SSE2)
+	#include <emmintrin.h>
+#endif
+
+namespace gmmstd{
+
+
+// ---------------------------------------------------------
+// distanza di Mahalanobis diagonale: sum_m iv[m] * (x[m]-mu[m])^2
+
+template <typename Real>
+static inline Real MahalanobisDiag_scalar(const Real *x, const Real *mu, const Real *iv, int M)
+{
+	Real dValue = 0;
+	for (int m=0; m<M; m++){
+		Real dDiff = x[m]-mu[m];
+		dValue += iv[m]*dDiff*dDiff;
+	}
+	return dValue;
+}
+
+#if defined(GMMSTD_SIMD_AVX2)
+
+double MahalanobisDiag(const double *x, const double *mu, const double *iv, int M)
+{
+	__m256d acc = _mm256_setzero_pd();
+	int m=0;
+	for (; m+4<=M; m+=4){
+		__m256d d = _mm256_sub_pd(_mm256_loadu_pd(x+m), _mm256_loadu_pd(mu+m));
+		acc = _mm256_fmadd_pd(_mm256_mul_pd(d, _mm256_loadu_pd(iv+m)), d, acc);
+	}
+	__m128d s = _mm_add_pd(_mm256_castpd256_pd128(acc), _mm256_extractf128_pd(acc,1));
+	s = _mm_add_sd(s, _mm_unpackhi_pd(s,s));
+	return _mm_cvtsd_f64(s) + MahalanobisDiag_scalar(x+m, mu+m, iv+m, M-m);
+}
+
+float MahalanobisDiag(const float *x, const float *mu, const float *iv, int M)
+{
+	__m256 acc = _mm256_setzero_ps();
+	int m=0;
+	for (; m+8<=M; m+=8){
+		__m256 d = _mm256_sub_ps(_mm256_loadu_ps(x+m), _mm256_loadu_ps(mu+m));
+		acc = _mm256_fmadd_ps(_mm256_mul_ps(d, _mm256_loadu_ps(iv+m)), d, acc);
+	}
+	__m128 s = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc,1));
+	s = _mm_add_ps(s, _mm_movehl_ps(s,s));
+	s = _mm_add_ss(s, _mm_shuffle_ps(s,s,1));
+	return _mm_cvtss_f32(s) + MahalanobisDiag_scalar(x+m, mu+m, iv+m, M-m);
+}
+
+#elif defined(GMMSTD_SIMD_SSE2)
+
+double MahalanobisDiag(const double *x, const double *mu, const double *iv, int M)
+{
+	__m128d acc = _mm_setzero_pd();
+	int m=0;
+	for (; m+2<=M; m+=2){
+		__m128d d = _mm_sub_pd(_mm_loadu_pd(x+m), _mm_loadu_pd(mu+m));
+		acc = _mm_add_pd(acc, _mm_mul_pd(_mm_mul_pd(d, _mm_loadu_pd(iv+m)), d));
+	}
+	acc = _mm_add_sd(acc, _mm_unpackhi_pd(acc,acc));
+	return _mm_cvtsd_f64(acc) + MahalanobisDiag_scalar(x+m, mu+m, iv+m, M-m);
+}
+
+float MahalanobisDiag(const float *x, const float *mu, const float *iv, int M)
+{
+	__m128 acc = _mm_setzero_ps();
+	int m=0;
+	for (; m+4<=M; m+=4){
+		__m128 d = _mm_sub_ps(_mm_loadu_ps(x+m), _mm_loadu_ps(mu+m));
+		acc = _mm_add_ps(acc, _mm_mul_ps(_mm_mul_ps(d, _mm_loadu_ps(iv+m)), d));
+	}
+	acc = _mm_add_ps(acc, _mm_movehl_ps(acc,acc));
+	acc = _mm_add_ss(acc, _mm_shuffle_ps(acc,acc,1));
+	return _mm_cvtss_f32(acc) + MahalanobisDiag_scalar(x+m, mu+m, iv+m, M-m);
+}
+
+#else
+
+double MahalanobisDiag(const double *x, const double *mu, const double *iv, int M)
+{
+	return MahalanobisDiag_scalar(x, mu, iv, M);
+}
+
+float MahalanobisDiag(const float *x, const float *mu, const float *iv, int M)
+{
+	return MahalanobisDiag_scalar(x, mu, iv, M);
+}
+
+#endif
+
+
+// ---------------------------------------------------------
+// exp vettoriale per la log-sum-exp (polinomi di Cephes, argomento gia' <= 0)
+
+#if defined(GMMSTD_SIMD_AVX2)
+
+static inline __m256d exp_pd(__m256d x)
+{
+	x = _mm256_max_pd(x, _mm256_set1_pd(-708.39641853226408));
+	x = _mm256_min_pd(x, _mm256_set1_pd(709.78271289338397));
+
+	// x = n ln2 + r, |r| <= ln2/2
+	__m256d n = _mm256_round_pd(_mm256_mul_pd(x, _mm256_set1_pd(1.4426950408889634073599)), _MM_FROUND_TO_NEAREST_INT|_MM_FROUND_NO_EXC);
+	__m256d r = _mm256_fnmadd_pd(n, _mm256_set1_pd(6.93145751953125E-1), x);
+	r = _mm256_fnmadd_pd(n, _mm256_set1_pd(1.42860682030941723212E-6), r);
+
+	// exp(r) = 1 + 2 r P(r^2) / (Q(r^2) - r P(r^2))
+	__m256d rr = _mm256_mul_pd(r, r);
+	__m256d p = _mm256_set1_pd(1.26177193074810590878E-4);
+	p = _mm256_fmadd_pd(p, rr, _mm256_set1_pd(3.02994407707441961300E-2));
+	p = _mm256_fmadd_pd(p, rr, _mm256_set1_pd(9.99999999999999999910E-1));
+	p = _mm256_mul_pd(p, r);
+	__m256d q = _mm256_set1_pd(3.00198505138664455042E-6);
+	q = _mm256_fmadd_pd(q, rr, _mm256_set1_pd(2.52448340349684104192E-3));
+	q = _mm256_fmadd_pd(q, rr, _mm256_set1_pd(2.27265548208155028766E-1));
+	q = _mm256_fmadd_pd(q, rr, _mm256_set1_pd(2.00000000000000000009E0));
+	__m256d e = _mm256_div_pd(p, _mm256_sub_pd(q, p));
+	e = _mm256_fmadd_pd(e, _mm256_set1_pd(2.0), _mm256_set1_pd(1.0));
+
+	// * 2^n
+	__m256i ni = _mm256_cvtepi32_epi64(_mm256_cvtpd_epi32(n));
+	ni = _mm256_slli_epi64(_mm256_add_epi64(ni, _mm256_set1_epi64x(1023)), 52);
+	return _mm256_mul_pd(e, _mm256_castsi256_pd(ni));
+}
+
+static inline __m256 exp_ps(__m256 x)
+{
+	x = _mm256_max_ps(x, _mm256_set1_ps(-87.3365447504f));
+	x = _mm256_min_ps(x, _mm256_set1_ps(88.3762626647f));
+
+	__m256 n = _mm256_round_ps(_mm256_mul_ps(x, _mm256_set1_ps(1.44269504088896341f)), _MM_FROUND_TO_NEAREST_INT|_MM_FROUND_NO_EXC);
+	__m256 r = _mm256_fnmadd_ps(n, _mm256_set1_ps(0.693359375f), x);
+	r = _mm256_fnmadd_ps(n, _mm256_set1_ps(-2.12194440e-4f), r);
+
+	__m256 p = _mm256_set1_ps(1.9875691500E-4f);
+	p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(1.3981999507E-3f));
+	p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(8.3334519073E-3f));
+	p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(4.1665795894E-2f));
+	p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(1.6666665459E-1f));
+	p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(5.0000001201E-1f));
+	p = _mm256_fmadd_ps(p, _mm256_mul_ps(r,r), _mm256_add_ps(r, _mm256_set1_ps(1.0f)));
+
+	__m256i ni = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127)), 23);
+	return _mm256_mul_ps(p, _mm256_castsi256_ps(ni));
+}
+
+// somma di exp(in[k*iStep+t] - mx[t]) su k, 4 (double) o 8 (float) frame alla volta;
+// ritorna il primo frame non elaborato
+static inline int SumExpBlock(const double *in, int K, int T, int iStep, const double *mx, double *sum)
+{
+	int t=0;
+	for (; t+4<=T; t+=4){
+		__m256d m = _mm256_loadu_pd(mx+t);
+		__m256d s = _mm256_setzero_pd();
+		for (int k=0; k<K; k++)
+			s = _mm256_add_pd(s, exp_pd(_mm256_sub_pd(_mm256_loadu_pd(in+k*iStep+t), m)));
+		_mm256_storeu_pd(sum+t, s);
+	}
+	return t;
+}
+
+static inline int SumExpBlock(const float *in, int K, int T, int iStep, const float *mx, float *sum)
+{
+	int t=0;
+	for (; t+8<=T; t+=8){
+		__m256 m = _mm256_loadu_ps(mx+t);
+		__m256 s = _mm256_setzero_ps();
+		for (int k=0; k<K; k++)
+			s = _mm256_add_ps(s, exp_ps(_mm256_sub_ps(_mm256_loadu_ps(in+k*iStep+t), m)));
+		_mm256_storeu_ps(sum+t, s);
+	}
+	return t;
+}
+
+#else
+
+// senza AVX2 la exp resta scalare
+template <typename Real>
+static inline int SumExpBlock(const Real *, int, int, int, const Real *, Real *)
+{
+	return 0;
+}
+
+#endif
+
+
+template <typename Real>
+void LogSumExpColumns(const Real *in, int K, int T, int iStep, Real *out, int iOutStep)
+{
+	if (T<=0)
+		return;
+	const Real dMinusInf = -std::numeric_limits<Real>::infinity();
+	if (K<=0){
+		for (int t=0; t<T; t++)
+			out[t*iOutStep] = dMinusInf;
+		return;
+	}
+	if (K==1){
+		for (int t=0; t<T; t++)
+			out[t*iOutStep] = in[t];
+		return;
+	}
+
+	std::vector<Real> mx (in, in+T);
+	std::vector<Real> sum (T);
+
+	// massimo sulle gaussiane (il compilatore lo vettorizza: righe contigue)
+	int t,k;
+	for (k=1; k<K; k++){
+		const Real *row = in+k*iStep;
+		for (t=0; t<T; t++)
+			if (row[t] > mx[t])
+				mx[t] = row[t];
+	}
+
+	// somma degli exp scalati sul massimo
+	t = SumExpBlock(in, K, T, iStep, &mx[0], &sum[0]);
+	for (; t<T; t++){
+		Real s = 0;
+		for (k=0; k<K; k++)
+			s += exp(in[k*iStep+t]-mx[t]);
+		sum[t] = s;
+	}
+
+	for (t=0; t<T; t++)
+		out[t*iOutStep] = (mx[t]==dMinusInf) ? dMinusInf : mx[t] + log(sum[t]); // tutti i pesi nulli
+}
+
+
+void ExpShifted(const double *in, int n, double shift, double *out)
+{
+	int i=0;
+#if defined(GMMSTD_SIMD_AVX2)
+	// exp_pd satura a exp(-708): i -inf (probabilita' nulle) vanno rimessi a 0 esplicitamente
+	const __m256d s = _mm256_set1_pd(shift);
+	const __m256d minusInf = _mm256_set1_pd(-std::numeric_limits<double>::infinity());
+	for (; i+4<=n; i+=4){
+		__m256d x = _mm256_loadu_pd(in+i);
+		__m256d e = exp_pd(_mm256_sub_pd(x, s));
+		_mm256_storeu_pd(out+i, _mm256_andnot_pd(_mm256_cmp_pd(x, minusInf, _CMP_EQ_OQ), e));
+	}
+#endif
+	for (; i<n; i++)
+		out[i] = exp(in[i]-shift);
+}
+
+
+double LogSumExp(const double *in, int n, double *work)
+{
+	const double dMinusInf = -std::numeric_limits<double>::infinity();
+	if (n<=0)
+		return dMinusInf;
+	double dMax = in[0];
+	for (int i=1; i<n; i++)
+		if (in[i] > dMax)
+			dMax = in[i];
+	if (dMax==dMinusInf)
+		return dMinusInf;
+	ExpShifted(in, n, dMax, work);
+	double dSum = 0;
+	for (int i=0; i<n; i++)
+		dSum += work[i];
+	return dMax + log(dSum);
+}
+
+
+// ---------------------------------------------------------
+
+template <typename Real>
+CGMM_packed<Real>::CGMM_packed():
+	m_bPacked(false), m_iM(0), m_iK(0)
+{
+}
+
+
+template <typename Real>
+bool CGMM_packed<Real>::Pack(CGMM_tiny &gmm)
+{
+	m_bPacked = false;
+	m_iM = gmm.GetSize();
+	m_iK = gmm.GetGaussiansNumber();
+	m_means.resize(m_iK*m_iM);
+	m_invVar.resize(m_iK*m_iM);
+	m_logConst.resize(m_iK);
+
+	for (unsigned int k=0; k<m_iK; k++){
+		CGaussian &g = gmm.GetGaussian(k);
+		g.UpdateInverse();
+		if (!g.IsDiagonal())
+			return false;
+		for (unsigned int m=0; m<m_iM; m++){
+			m_means[k*m_iM+m] = (Real)g.m_means(m,0);
+			m_invVar[k*m_iM+m] = (Real)g.m_InverseVariance(m,0);
+		}
+		m_logConst[k] = (Real)(log(gmm.WeightValue(k)) + g.m_dLogNormalizer);
+	}
+
+	m_bPacked = true;
+	return true;
+}
+
+
+template <typename Real>
+void CGMM_packed<Real>::ComponentLogLikelihoods(const Real *obs, int T, int iObsStep, Real *logLK, int iOutStep) const
+{
+	assert(m_bPacked);
+	for (int t=0; t<T; t++){
+		const Real *x = obs + t*iObsStep;
+		for (unsigned int k=0; k<m_iK; k++)
+			logLK[t*iOutStep+k] = m_logConst[k] - (Real)0.5 * MahalanobisDiag(x, &m_means[k*m_iM], &m_invVar[k*m_iM], m_iM);
+	}
+}
+
+
+template <typename Real>
+void CGMM_packed<Real>::LogLikelihoods(const Real *obs, int T, int iObsStep, Real *logL, int iOutStep) const
+{
+	assert(m_bPacked);
+	if (T<=0)
+		return;
+
+	if (m_iK==0){
+		LogSumExpColumns<Real>(NULL, 0, T, T, logL, iOutStep);
+		return;
+	}
+
+	// shortcut for one subclass
+	if (m_iK==1){
+		for (int t=0; t<T; t++)
+			logL[t*iOutStep] = m_logConst[0] - (Real)0.5 * MahalanobisDiag(obs + t*iObsStep, &m_means[0], &m_invVar[0], m_iM);
+		return;
+	}
+
+	// K x T, una riga per gaussiana, poi log-sum-exp sulle colonne
+	std::vector<Real> work (m_iK*T);
+	for (unsigned int k=0; k<m_iK; k++)
+		for (int t=0; t<T; t++)
+			work[k*T+t] = m_logConst[k] - (Real)0.5 * MahalanobisDiag(obs + t*iObsStep, &m_means[k*m_iM], &m_invVar[k*m_iM], m_iM);
+	LogSumExpColumns(&work[0], m_iK, T, T, logL, iOutStep);
+}
+
+
+// istanze usate
+template class CGMM_packed<double>;
+template class CGMM_packed<float>;
+template void LogSumExpColumns<double>(const double *, int, int, int, double *, int);
+template void LogSumExpColumns<float>(const float *, int, int, int, float *, int);
+
+
+} // namespace
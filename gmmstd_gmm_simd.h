@@ -0,0 +1,90 @@
+//------------------------------------------------------------------
+//
+// Nome file: gmm_simd.h
+// Contenuto: log-likelihood di GMM diagonali su blocchi di osservazioni
+//            (kernel vettoriali AVX2/SSE2, double e float)
+//
+//------------------------------------------------------------------
+
+
+#pragma once
+
+#include <vector>
+
+#include "gmmstd_gmm_tiny.h"
+
+// scelta del set di istruzioni a tempo di compilazione (in x64 SSE2 c'e' sempre).
+// Il percorso AVX2 usa anche le FMA, che sono un set a parte: con GCC/Clang servono
+// -mavx2 -mfma (solo -mavx2 -> SSE2), con VS /arch:AVX2 abilita entrambi ma non definisce __FMA__
+#if defined(__AVX2__) && (defined(__FMA__) || defined(_MSC_VER))
+	#define GMMSTD_SIMD_AVX2
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#define GMMSTD_SIMD_SSE2
+#endif
+
+
+namespace gmmstd{
+
+
+// Parametri di una CGMM_tiny con covarianze diagonali, copiati in array contigui
+// (structure of arrays): per la k-esima gaussiana
+//   m_means[k*M .. k*M+M-1]    medie
+//   m_invVar[k*M .. k*M+M-1]   inverso delle varianze
+//   m_logConst[k]              log(w_k) - (M/2) log(2 pi) - 0.5 log|Sigma_k|
+// cosi' log(w_k N_k(x)) = m_logConst[k] - 0.5 * sum_m m_invVar[m] (x[m]-m_means[m])^2
+// e il kernel scorre la memoria in modo lineare.
+// Va ricostruita (Pack) ogni volta che cambiano i parametri della GMM.
+template <typename Real>
+class CGMM_packed
+{
+public:
+	CGMM_packed();
+
+	// copia i parametri; ritorna false (e non e' utilizzabile) se una delle gaussiane
+	// non e' diagonale
+	bool Pack(CGMM_tiny &gmm);
+
+	bool IsPacked() const {
+		return m_bPacked; }
+	unsigned int GetSize() const {
+		return m_iM; }
+	unsigned int GetGaussiansNumber() const {
+		return m_iK; }
+
+	// obs: T osservazioni di M valori, la t-esima inizia a obs + t*iObsStep
+	// logLK: T x K, logLK[t*iOutStep + k] = log(w_k) + log N_k(obs_t)
+	void ComponentLogLikelihoods(const Real *obs, int T, int iObsStep, Real *logLK, int iOutStep) const;
+
+	// logL[t*iOutStep] = log sum_k w_k N_k(obs_t) (log-sum-exp sulle gaussiane)
+	void LogLikelihoods(const Real *obs, int T, int iObsStep, Real *logL, int iOutStep=1) const;
+
+private:
+	bool m_bPacked;
+	unsigned int m_iM;
+	unsigned int m_iK;
+	std::vector<Real> m_means;
+	std::vector<Real> m_invVar;
+	std::vector<Real> m_logConst;
+};
+
+
+// sum_m iv[m] * (x[m]-mu[m])^2, il kernel usato da CGMM_packed
+double MahalanobisDiag(const double *x, const double *mu, const double *iv, int M);
+float MahalanobisDiag(const float *x, const float *mu, const float *iv, int M);
+
+
+// out[t] = log sum_k exp(in[k*iStep + t]), per t=0..T-1 (in: K righe da T valori)
+// vettorizzata sui frame
+template <typename Real>
+void LogSumExpColumns(const Real *in, int K, int T, int iStep, Real *out, int iOutStep=1);
+
+// out[i] = exp(in[i] - shift), i=0..n-1, con in[i] <= shift (shift = massimo di in):
+// la parte esponenziale delle log-sum-exp sugli stati di forward e backward nel dominio dei log
+void ExpShifted(const double *in, int n, double shift, double *out);
+
+// log sum_i exp(in[i]) su n valori (-inf se sono tutti -inf); work: n double di appoggio
+double LogSumExp(const double *in, int n, double *work);
+
+
+} // namespace
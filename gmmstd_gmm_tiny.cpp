@@ -10,6 +10,7 @@
 
 
 #include "gmmstd_gmm_tiny.h"
+#include "gmmstd_gmm_simd.h"
 #include <time.h>
 
 namespace gmmstd{
@@ -70,6 +71,7 @@ double random_Uniform(double lowest, double highest) {
 			m_means(i,0)=random_Uniform(-1,1);
 			m_covariance(i,i)=random_Uniform(1,2);
 		}
+		InvalidateInverse();
 		return true;
 	}
 
@@ -77,42 +79,105 @@ double random_Uniform(double lowest, double highest) {
 
 #define LOG2PI 1.83787
 
+	// ricalcola la matrice inversa della covarianza
+	bool CGaussian::InverseRecalc(){
+		assert (m_InverseCovariance.size[0]==m_covariance.size[0]);
+		assert (m_InverseCovariance.size[1]==m_covariance.size[1]);
+
+		// controllo se la covarianza e' diagonale
+		m_bDiagonal = true;
+		int i,j;
+		for (i=0; i<m_iSize && m_bDiagonal; i++)
+			for (j=0; j<m_iSize; j++)
+				if (i!=j && m_covariance(i,j)!=0){
+					m_bDiagonal = false;
+					break;
+				}
+
+		if (m_bDiagonal){
+			// diagonale: log determinante = somma dei log delle varianze, inversa = 1/varianze.
+			// Il prodotto delle varianze andrebbe in underflow (tante varianze piccole, es: DELTA)
+			// o in overflow anche con varianze tutte valide: si somma direttamente in log.
+			bool bPositive = true;
+			double dLogDetermin = 0;
+			for (i=0; i<m_iSize; i++){
+				if (m_covariance(i,i) <= 0){
+					bPositive = false;
+					break;
+				}
+				dLogDetermin += log(m_covariance(i,i));
+			}
+			assert (bPositive);
+			if (bPositive){
+				m_InverseVariance.create(m_iSize,1);
+				m_InverseCovariance = Mat_<double>::zeros(m_iSize,m_iSize);
+				for (i=0; i<m_iSize; i++){
+					m_InverseVariance(i,0) = 1.0/m_covariance(i,i);
+					m_InverseCovariance(i,i) = m_InverseVariance(i,0);
+				}
+				m_dLogCovarianceDeterminant = dLogDetermin;
+			}
+			else
+				m_bDiagonal = false; // varianza nulla o negativa: resta l'inversa precedente, come nel caso pieno
+		}
+		else {
+			double dDetermin;
+			dDetermin = determinant(m_covariance);
+			assert (dDetermin);
+			if (dDetermin!=0){
+				m_InverseCovariance = m_covariance.clone();
+				m_InverseCovariance=m_InverseCovariance.inv();
+				m_dLogCovarianceDeterminant = log(dDetermin);
+			}
+			double dDetermin2;
+			dDetermin2 = determinant(m_InverseCovariance);
+			assert(dDetermin2);
+		}
+
+		m_dLogNormalizer = -(((double)m_iSize/2.0) * LOG2PI) - 0.5 * m_dLogCovarianceDeterminant;
+		m_bInverseValid = true;
+		return true;
+	}
+
+
 	// calcolo likelihood 
 	double CGaussian::GetLogLikelihood(const vector<double> &value, bool bRecalcInverse){
-		// inversa della matrice di covarianza (solo se richiesto)
+		// inversa della matrice di covarianza (in cache, ricalcolata solo se i parametri sono cambiati)
 	//	cout << m_covariance(0,0) << " <Cov " << endl;
 	//	cout << m_InverseCovariance(0,0) << " <invCov " << endl;
 
-		if (bRecalcInverse) 
-			InverseRecalc();
-
-		
-
-		double dConst;
-	
-		dConst = -(((double)m_iSize/2.0) * LOG2PI) - 0.5 * m_dLogCovarianceDeterminant;
+		UpdateInverse();
 
 		//calcolo prodotto (x-m)' Sigma^-1 (x-m)
 		double dValue=0;
 		unsigned int i,j;
-		for (i=0; i<m_iSize;i++){
-			double dInnerValue=0;
-			for (j=0; j<m_iSize;j++)
-			{
-				//cout  << m_InverseCovariance(i,j) << " " << value[j] << " " << m_means(j,0) << endl;
-				dInnerValue+= m_InverseCovariance(i,j)*(value[j]-m_means(j,0));
-				//cout << dInnerValue << endl;
-
+		if (m_bDiagonal){
+			// covarianza diagonale: O(M)
+			for (i=0; i<m_iSize;i++){
+				double dDiff = value[i]-m_means(i,0);
+				dValue += m_InverseVariance(i,0) * dDiff * dDiff;
 			}
+		}
+		else {
+			for (i=0; i<m_iSize;i++){
+				double dInnerValue=0;
+				for (j=0; j<m_iSize;j++)
+				{
+					//cout  << m_InverseCovariance(i,j) << " " << value[j] << " " << m_means(j,0) << endl;
+					dInnerValue+= m_InverseCovariance(i,j)*(value[j]-m_means(j,0));
+					//cout << dInnerValue << endl;
+
+				}
 
-			dValue += dInnerValue * (value[i]-m_means(i,0));
-			//cout << dValue << endl;
+				dValue += dInnerValue * (value[i]-m_means(i,0));
+				//cout << dValue << endl;
+			}
 		}
 
 		//cout << dValue << endl;
 
 		// loglikelihood finale
-		dValue = dConst - 0.5 * dValue;
+		dValue = m_dLogNormalizer - 0.5 * dValue;
 
 
 		return dValue;
@@ -121,47 +186,17 @@ double random_Uniform(double lowest, double highest) {
 
 	double CGaussian::GetLikelihood(const vector<double> &value, bool bRecalcInverse){
 
-		// inversa della matrice di covarianza (solo se richiesto)
-		if (bRecalcInverse) 
-			InverseRecalc();
-
-		double dConst;
-		dConst = -(((double)m_iSize/2.0) * LOG2PI) - 0.5 * m_dLogCovarianceDeterminant;
-
-		//calcolo prodotto (x-m)' Sigma^-1 (x-m)
-		double dValue=0;
-		unsigned int i,j;
-		for (i=0; i<m_iSize;i++){
-			double dInnerValue=0;
-			for (j=0; j<m_iSize;j++)
-			{
-				//cout  << m_InverseCovariance(i,j) << " " << value[j] << " " << m_means(j,0) << endl;
-				dInnerValue+= m_InverseCovariance(i,j)*(value[j]-m_means(j,0));
-				//cout << dInnerValue << endl;
-
-			}
-
-			dValue += dInnerValue * (value[i]-m_means(i,0));
-			//cout << dValue << endl;
-		}
-
-		//cout << dValue << endl;
-
-		// loglikelihood finale
-		dValue = dConst - 0.5 * dValue;
-
 		// soglia per evitare valori piccoli underflow?!?
 		/*if (dValue <= THLOG) 
 			return 0;
 			*/
 
-		return exp(dValue);
+		return exp(GetLogLikelihood(value,bRecalcInverse));
 	}
 
 
 	
 
-
 	bool CGaussian::ReSize(unsigned int iSize){
 		// cambio le dimensioni dei vettori
 		m_iSize = iSize;
@@ -178,7 +213,7 @@ double random_Uniform(double lowest, double highest) {
 		m_means = means.clone();
 		m_covariance = covariance.clone();
 		m_iSize =means.rows;
-		InverseRecalc();
+		InvalidateInverse();
 		return true;
 	}
 
@@ -191,6 +226,10 @@ double random_Uniform(double lowest, double highest) {
 		m_InverseCovariance.create(m_iSize,m_iSize);
 		m_InverseCovariance= Mat_<double>::eye(m_iSize,m_iSize);
 		m_dLogCovarianceDeterminant=0;
+		m_bDiagonal = true;
+		m_InverseVariance = Mat_<double>::ones(m_iSize,1);
+		m_dLogNormalizer = -(((double)m_iSize/2.0) * LOG2PI);
+		m_bInverseValid = true;
 		return true;
 	}
 
@@ -232,6 +271,9 @@ double random_Uniform(double lowest, double highest) {
 						
 			fread(&m_dLogCovarianceDeterminant,sizeof(double),1,f);
 
+			// inversa e determinante letti dal file non vengono usati: li ricalcolo dalla covarianza al primo utilizzo
+			InvalidateInverse();
+
 		return true;
 	}
 
@@ -286,6 +328,13 @@ double random_Uniform(double lowest, double highest) {
 		}
 
 
+		bool CGMM_tiny::UpdateInverse(){
+			for (unsigned int i=0; i<m_iK; i++)
+				m_Gaussians[i].UpdateInverse();
+			return true;
+		}
+
+
 		// lettura delle dimensioni
 		unsigned int CGMM_tiny::GetSize(){
 			return m_iM;
@@ -420,6 +469,108 @@ double random_Uniform(double lowest, double highest) {
       }
 
 
+		// log(sum_k w_k N_k(value)) senza soglie: i termini sono scalati sul massimo per non andare in underflow
+		double CGMM_tiny::GetLogLikelihood_exact (const vector<double> &value, bool bRecalc){
+			if (m_iK==0) return log(0.);
+
+			// shortcut for one subclass
+			if (m_iK==1)
+				return log(m_weights[0]) + m_Gaussians[0].GetLogLikelihood(value,bRecalc);
+
+			vector<double> vdLL (m_iK);
+			double dBestLL = -DBL_MAX;
+			unsigned int i;
+			for (i=0; i<m_iK; i++){
+				vdLL[i] = log(m_weights[i]) + m_Gaussians[i].GetLogLikelihood(value,bRecalc);
+				if (vdLL[i] > dBestLL)
+					dBestLL = vdLL[i];
+			}
+
+			if (dBestLL == -DBL_MAX) // tutti i pesi nulli
+				return log(0.);
+
+			double dValue = 0;
+			for (i=0; i<m_iK; i++)
+				dValue += exp(vdLL[i] - dBestLL);
+
+			return dBestLL + log(dValue);
+		}
+
+
+		// -----------------------------------------
+		// Funzioni per la likelihood di un blocco di osservazioni
+
+		// versione senza kernel vettoriali (covarianze piene): una riga alla volta
+		template <typename Real>
+		static void ComponentLogLikelihoods_rows(CGMM_tiny &gmm, const Mat_<Real> &obs, Mat_<Real> &logLK)
+		{
+			vector<double> value (obs.cols);
+			for (int t=0; t<obs.rows; t++){
+				for (int m=0; m<obs.cols; m++)
+					value[m] = obs(t,m);
+				for (unsigned int k=0; k<gmm.m_iK; k++)
+					logLK(t,k) = (Real)(log(gmm.m_weights[k]) + gmm.m_Gaussians[k].GetLogLikelihood(value));
+			}
+		}
+
+		template <typename Real>
+		static void LogLikelihood_rows(CGMM_tiny &gmm, const Mat_<Real> &obs, Mat_<Real> &logL)
+		{
+			vector<double> value (obs.cols);
+			for (int t=0; t<obs.rows; t++){
+				for (int m=0; m<obs.cols; m++)
+					value[m] = obs(t,m);
+				logL(t,0) = (Real)gmm.GetLogLikelihood_exact(value);
+			}
+		}
+
+		template <typename Real>
+		static void ComponentLogLikelihoods_batch(CGMM_tiny &gmm, const Mat_<Real> &obs, Mat_<Real> &logLK)
+		{
+			assert(obs.cols == (int)gmm.m_iM);
+			logLK.create(obs.rows, gmm.m_iK);
+			CGMM_packed<Real> packed;
+			if (obs.rows==0 || gmm.m_iK==0)
+				return;
+			if (!packed.Pack(gmm)){
+				ComponentLogLikelihoods_rows(gmm, obs, logLK);
+				return;
+			}
+			packed.ComponentLogLikelihoods(obs[0], obs.rows, (int)(obs.step[0]/sizeof(Real)), logLK[0], (int)(logLK.step[0]/sizeof(Real)));
+		}
+
+		template <typename Real>
+		static void LogLikelihood_batch(CGMM_tiny &gmm, const Mat_<Real> &obs, Mat_<Real> &logL)
+		{
+			assert(obs.cols == (int)gmm.m_iM);
+			logL.create(obs.rows, 1);
+			CGMM_packed<Real> packed;
+			if (obs.rows==0)
+				return;
+			if (!packed.Pack(gmm)){
+				LogLikelihood_rows(gmm, obs, logL);
+				return;
+			}
+			packed.LogLikelihoods(obs[0], obs.rows, (int)(obs.step[0]/sizeof(Real)), logL[0], (int)(logL.step[0]/sizeof(Real)));
+		}
+
+		void CGMM_tiny::GetComponentLogLikelihoods (const Mat_<double> &obs, Mat_<double> &logLK){
+			ComponentLogLikelihoods_batch(*this, obs, logLK);
+		}
+
+		void CGMM_tiny::GetComponentLogLikelihoods (const Mat_<float> &obs, Mat_<float> &logLK){
+			ComponentLogLikelihoods_batch(*this, obs, logLK);
+		}
+
+		void CGMM_tiny::GetLogLikelihood_batch (const Mat_<double> &obs, Mat_<double> &logL){
+			LogLikelihood_batch(*this, obs, logL);
+		}
+
+		void CGMM_tiny::GetLogLikelihood_batch (const Mat_<float> &obs, Mat_<float> &logL){
+			LogLikelihood_batch(*this, obs, logL);
+		}
+
+
 		// calcolo della likelihood di un valore ristretta ad una sola gaussiana
 		double CGMM_tiny::GetLogLikelihood_partial (const vector<double> &value, int iIndex,bool bRecalc){
 			double dVal;
@@ -516,6 +667,11 @@ double random_Uniform(double lowest, double highest) {
 
 		// accesso al (j,k)-esima cella della matrice di covarianza della i-esima gaussiana
 		double& CGMM_tiny::CoVarianceValue(int iGaussianIndex, int jIndex, int kIndex){
+			m_Gaussians[iGaussianIndex].InvalidateInverse();
+			return m_Gaussians[iGaussianIndex].m_covariance(jIndex,kIndex);
+		}
+
+		double CGMM_tiny::CoVarianceValue(int iGaussianIndex, int jIndex, int kIndex) const{
 			return m_Gaussians[iGaussianIndex].m_covariance(jIndex,kIndex);
 		}
 
@@ -20,13 +20,29 @@
 
 #include <vector>
 #include <iterator>
+#include <utility>
 
 using namespace cv;
 using namespace std;
 
+// noexcept non e' supportato da Visual Studio prima del 2015
+#if defined(_MSC_VER) && _MSC_VER < 1900
+#define GMMSTD_NOEXCEPT throw()
+#else
+#define GMMSTD_NOEXCEPT noexcept
+#endif
+
 
 namespace gmmstd{
 
+// "sposta" un Mat_ in dst: OpenCV 2.4 non ha costruttori di move, quindi dst condivide
+// i dati di src (solo il contatore dei riferimenti) e src viene svuotato. Nessuna copia dei dati.
+template <typename T>
+inline void MoveMat(Mat_<T> &dst, Mat_<T> &src) GMMSTD_NOEXCEPT {
+	dst = src;
+	src.release();
+}
+
 double rand_BoxMuller();
 double random_Uniform(double lowest, double highest) ;
 
@@ -39,7 +55,7 @@ class CGaussian
 public:
 	
 	CGaussian():
-	   m_iSize (1), m_means(1,1,0.),m_covariance(1,1,0.), m_InverseCovariance(1,1,0.)
+	   m_iSize (1), m_means(1,1,0.),m_covariance(1,1,0.), m_InverseCovariance(1,1,0.), m_bInverseValid(false)
 		{	SetToNormal();	}
 	
 	   // copy constructor
@@ -50,6 +66,10 @@ public:
 		   m_covariance= ref.m_covariance.clone();
 		   m_InverseCovariance= ref.m_InverseCovariance.clone();
 		   m_dLogCovarianceDeterminant = ref.m_dLogCovarianceDeterminant;
+		   m_bInverseValid = ref.m_bInverseValid;
+		   m_bDiagonal = ref.m_bDiagonal;
+		   m_InverseVariance = ref.m_InverseVariance.clone();
+		   m_dLogNormalizer = ref.m_dLogNormalizer;
 	   }
 
 	   //assegnamento
@@ -60,12 +80,40 @@ public:
 		   m_covariance= ref.m_covariance.clone();
 		   m_InverseCovariance= ref.m_InverseCovariance.clone();
 		   m_dLogCovarianceDeterminant = ref.m_dLogCovarianceDeterminant;
+		   m_bInverseValid = ref.m_bInverseValid;
+		   m_bDiagonal = ref.m_bDiagonal;
+		   m_InverseVariance = ref.m_InverseVariance.clone();
+		   m_dLogNormalizer = ref.m_dLogNormalizer;
+		   return *this;
+	   }
+
+	   // move: le matrici passano a questa gaussiana senza clone, ref resta vuota
+	   CGaussian(CGaussian && ref) GMMSTD_NOEXCEPT
+	   {
+		   *this = std::move(ref);
+	   }
+
+	   CGaussian & operator= (CGaussian && ref) GMMSTD_NOEXCEPT
+	   {
+		   if (this == &ref)
+			   return *this;
+		   m_iSize = ref.m_iSize;
+		   MoveMat(m_means, ref.m_means);
+		   MoveMat(m_covariance, ref.m_covariance);
+		   MoveMat(m_InverseCovariance, ref.m_InverseCovariance);
+		   m_dLogCovarianceDeterminant = ref.m_dLogCovarianceDeterminant;
+		   m_bInverseValid = ref.m_bInverseValid;
+		   m_bDiagonal = ref.m_bDiagonal;
+		   MoveMat(m_InverseVariance, ref.m_InverseVariance);
+		   m_dLogNormalizer = ref.m_dLogNormalizer;
+		   ref.m_iSize = 0;
+		   ref.m_bInverseValid = false;
 		   return *this;
 	   }
 
 
 	CGaussian  (const unsigned int iSize):
-		m_iSize (iSize), m_means(iSize,1,0.),m_covariance(iSize,iSize,0.), m_InverseCovariance(iSize,iSize,0.)
+		m_iSize (iSize), m_means(iSize,1,0.),m_covariance(iSize,iSize,0.), m_InverseCovariance(iSize,iSize,0.), m_bInverseValid(false)
 	{	SetToNormal(); }
 
 
@@ -90,29 +138,37 @@ public:
 	bool SetToNormal();
 
 	// calcolo likelihood con vector<double>
+	// bRecalcInverse e' rimasto per compatibilita': l'inversa e il determinante sono in cache
+	// e vengono ricalcolati solo se la covarianza e' stata modificata (vedi InvalidateInverse)
 	double GetLogLikelihood(const vector<double> &value, bool bRecalcInverse=true);
 	double GetLikelihood(const vector<double> &value, bool bRecalcInverse=true);
 
-	// ricalcola la matrice inversa della covarianza
-	bool InverseRecalc(){
-		assert (m_InverseCovariance.size[0]==m_covariance.size[0]);
-		assert (m_InverseCovariance.size[1]==m_covariance.size[1]);
-
-		double dDetermin;
-		dDetermin = determinant(m_covariance);
-		assert (dDetermin);
-		if (dDetermin!=0){
-			m_InverseCovariance = m_covariance.clone();
-			m_InverseCovariance=m_InverseCovariance.inv();
-			m_dLogCovarianceDeterminant = log(dDetermin);
-		}
-		double dDetermin2;
-		dDetermin2 = determinant(m_InverseCovariance);
-		assert(dDetermin2);
+	// da chiamare ogni volta che si scrive m_covariance direttamente
+	void InvalidateInverse(){
+		m_bInverseValid = false;
+	}
 
+	// ricalcola inversa e determinante solo se la cache non e' valida
+	bool UpdateInverse(){
+		if (!m_bInverseValid)
+			return InverseRecalc();
 		return true;
 	}
 
+	bool IsInverseValid() const {
+		return m_bInverseValid;
+	}
+
+	// ricalcola la matrice inversa della covarianza (e la costante di normalizzazione).
+	// Se la covarianza e' diagonale non inverte la matrice: salva l'inverso delle varianze
+	// e la likelihood viene calcolata in O(M) invece che in O(M^2)
+	bool InverseRecalc();
+
+	// true se la covarianza e' diagonale (aggiornato da InverseRecalc)
+	bool IsDiagonal() const {
+		return m_bDiagonal;
+	}
+
 	// un po' di funzioni di utilit, tipo  salvataggio e lettura su file
 	bool SaveToFile(FILE *f);
 	bool LoadFromFile(FILE *f);
@@ -126,6 +182,10 @@ public:
 	Mat_<double> m_covariance;
 	Mat_<double> m_InverseCovariance;
 	double m_dLogCovarianceDeterminant;
+	bool m_bInverseValid; // m_InverseCovariance e m_dLogCovarianceDeterminant corrispondono a m_covariance
+	bool m_bDiagonal; // covarianza diagonale: si usa m_InverseVariance
+	Mat_<double> m_InverseVariance; // M x 1, 1/sigma_ii (valido solo se m_bDiagonal)
+	double m_dLogNormalizer; // -(M/2) log(2 pi) - 0.5 log|Sigma|
 };
 
 
@@ -154,6 +214,37 @@ class CGMM_tiny{
 		{
 			;
 		}
+
+		// costruttore di move: le gaussiane passano a questa GMM, ref resta senza componenti
+		CGMM_tiny(CGMM_tiny &&ref) GMMSTD_NOEXCEPT:
+		m_iM(ref.m_iM), m_iK(ref.m_iK), m_Gaussians(std::move(ref.m_Gaussians)), m_weights(std::move(ref.m_weights)), m_bDiagonal(ref.m_bDiagonal)
+		{
+			ref.m_iK = 0;
+		}
+
+		// assegnamento
+		CGMM_tiny & operator= (const CGMM_tiny &ref){
+			m_iM = ref.m_iM;
+			m_iK = ref.m_iK;
+			m_Gaussians = ref.m_Gaussians;
+			m_weights = ref.m_weights;
+			m_bDiagonal = ref.m_bDiagonal;
+			return *this;
+		}
+
+		CGMM_tiny & operator= (CGMM_tiny &&ref) GMMSTD_NOEXCEPT {
+			if (this == &ref)
+				return *this;
+			m_iM = ref.m_iM;
+			m_iK = ref.m_iK;
+			m_Gaussians = std::move(ref.m_Gaussians);
+			m_weights = std::move(ref.m_weights);
+			m_bDiagonal = ref.m_bDiagonal;
+			ref.m_Gaussians.clear();
+			ref.m_weights.clear();
+			ref.m_iK = 0;
+			return *this;
+		}
 	
 		// costruttore: dimensione dello spazio delle feature M (default=1) e
 		// numero iniziale di gaussiane K (default=1)
@@ -178,9 +269,6 @@ class CGMM_tiny{
 		
 
 
-		// TODO: devo fare costruttore di copia e assegnamento
-
-
 
 		void ForceDiagonalCovariance(bool bForce){
 			m_bDiagonal=bForce;
@@ -197,6 +285,10 @@ class CGMM_tiny{
 		// inizializzazioni
 		bool RandomInit();
 
+		// porta in cache inversa e determinante di tutte le gaussiane
+		// (da chiamare dopo il caricamento, cosi' durante il testing non si inverte nulla)
+		bool UpdateInverse();
+
 		// lettura delle dimensioni
 		unsigned int GetSize();
 		unsigned int GetGaussiansNumber();
@@ -237,6 +329,23 @@ class CGMM_tiny{
 
 		// calcolo della likelihood di un valore ristretta ad una sola gaussiana
 		double GetLogLikelihood_partial (const vector<double> &value, int iIndex, bool bRecalc=true);
+
+		// log della likelihood della mixture, log(sum_k w_k N_k(value)), calcolato con log-sum-exp
+		// e senza le soglie THLOG di GetLogLikelihood: vale log(GetLikelihood(value)) anche quando
+		// GetLikelihood andrebbe in underflow. E' il valore salvato nella cache delle emissioni.
+		double GetLogLikelihood_exact (const vector<double> &value, bool bRecalc=true);
+		// ------------------------------------------
+
+		// -----------------------------------------
+		// Funzioni per la likelihood di un blocco di osservazioni (una per riga, T x M).
+		// Con covarianze diagonali usano i kernel vettoriali di gmmstd_gmm_simd,
+		// altrimenti ripiegano sulle funzioni per singolo vector.
+		// logLK T x K: log(w_k) + log N_k(obs_t)
+		void GetComponentLogLikelihoods (const Mat_<double> &obs, Mat_<double> &logLK);
+		void GetComponentLogLikelihoods (const Mat_<float> &obs, Mat_<float> &logLK);
+		// logL T x 1: come GetLogLikelihood_exact per ogni riga
+		void GetLogLikelihood_batch (const Mat_<double> &obs, Mat_<double> &logL);
+		void GetLogLikelihood_batch (const Mat_<float> &obs, Mat_<float> &logL);
 		// ------------------------------------------
 
 			
@@ -250,7 +359,12 @@ class CGMM_tiny{
 		// accesso alla j-esima cella del vettore delle medie della i-esima gaussiana
 		double& MeanValue(int iGaussianIndex, int jIndex);
 		// accesso al (j,k)-esima cella della matrice di covarianza della i-esima gaussiana
+		// (invalida la cache dell'inversa della gaussiana)
 		double& CoVarianceValue(int iGaussianIndex, int jIndex, int kIndex);
+		// lettura della stessa cella: non tocca la cache dell'inversa
+		double CoVarianceValue(int iGaussianIndex, int jIndex, int kIndex) const;
+		double GetCoVarianceValue(int iGaussianIndex, int jIndex, int kIndex) const {
+			return CoVarianceValue(iGaussianIndex, jIndex, kIndex); }
 		// accesso al peso della i-esima gaussiana
 		double& WeightValue(int iGaussianIndex);
 
@@ -28,6 +28,8 @@
 
 
 #include "gmmstd_gmm_tiny.h"
+#include "gmmstd_gmm_simd.h"
+#include "ThreadPool.h"
 namespace gmmstd{
 
 // classe per gli HMM che usano GMM come probabilit di emissione
@@ -79,6 +81,110 @@ int MeansAndVarianceVD (ForwardIterator1 Begin, ForwardIterator1 End, ForwardIte
 
 
 
+// stato della forward incrementale (una osservazione alla volta), nel dominio dei log:
+// log alpha al tempo corrente normalizzati (log sum_i alpha = 0) e somma dei log delle normalizzazioni.
+// E' tutto quello che serve per valutare una sequenza che cresce di un frame alla volta,
+// senza ripassare sulle osservazioni precedenti.
+class CForwardState{
+public:
+	CForwardState(): m_iT(0), m_dLogProb(0) {}
+
+	int m_iT;						// numero di osservazioni gia' consumate
+	double m_dLogProb;				// log P(O_0..O_t) (-inf se la sequenza e' impossibile per il modello)
+	vector<double> m_logAlpha;		// log alpha(t,i) normalizzati, i=0..N-1
+	vector<double> m_logAlphaNext;	// appoggio per il passo successivo
+	vector<double> m_work;			// appoggio della log-sum-exp (N)
+};
+
+
+// Un passo della forward incrementale in log, come una riga di ForwardLog: le emissioni non
+// passano mai per exp(logB), quindi emissioni piccolissime (sotto ~1e-308) non mandano
+// la scala a zero. pi (N) e A (N x N, riga i a A + i*iAStep) sono le probabilita' del modello.
+// Ritorna state.m_dLogProb.
+double ForwardStepLog(CForwardState &state, unsigned int N, const double *pi, const double *A, int iAStep, const double *logB);
+
+
+// Statistiche sufficienti dell'E-step di BaumWelch_Multiple.
+// Ogni thread ne accumula una copia sulle sequenze che prende; alla fine dell'iterazione
+// vengono sommate nell'ordine dei thread. Le sequenze vanno al primo thread libero, quindi con
+// piu' thread l'ordine delle somme (e le ultime cifre) puo' cambiare da un'esecuzione all'altra.
+// Con queste l'M-step e' in forma chiusa: non serve ripassare sulle osservazioni.
+class CBaumWelchStats{
+public:
+	CBaumWelchStats(): m_iN(0), m_iK(0), m_iM(0), m_bDiagonal(true), m_dLogProb(0) {}
+
+	// azzera tutto per un modello a N stati, K gaussiane per stato e feature di dimensione M;
+	// con bDiagonal i momenti del secondo ordine sono solo quelli diagonali
+	void Reset(unsigned int N, unsigned int K, unsigned int M, bool bDiagonal);
+	// somma le statistiche di un altro thread
+	void Add(const CBaumWelchStats &other);
+
+	// posizione della gaussiana k dello stato i nei vettori delle gaussiane
+	unsigned int Component(unsigned int i, unsigned int k) const {
+		return i*m_iK + k; }
+	// dimensione del blocco dei momenti del secondo ordine di una gaussiana
+	unsigned int SecondOrderSize() const {
+		return m_bDiagonal ? m_iM : m_iM*m_iM; }
+
+	unsigned int m_iN, m_iK, m_iM;
+	bool m_bDiagonal;
+	double m_dLogProb;		// sum_e log P(O_e|modello)
+	vector<double> m_pi;	// m_pi[i] = sum_e gamma_e(0,i)
+	vector<double> m_gamma;	// m_gamma[i] = sum_e sum_{t<T-1} gamma_e(t,i) (denominatore di A)
+	vector<double> m_xi;	// m_xi[i*N+j] = sum_e sum_{t<T-1} xi_e(t,i,j)
+	// per ogni gaussiana c = Component(i,k), con gammail(t) = gamma(t,i) * w_k N_k(O_t) / b_i(O_t):
+	vector<double> m_occ;		// m_occ[c] = sum gammail(t)                           (ordine 0)
+	vector<double> m_sum;		// m_sum[c*M+r] = sum gammail(t) O_t[r]                (ordine 1)
+	vector<double> m_sumSq;		// m_sumSq[c*SecondOrderSize()+...] = sum gammail(t) O_t[r] O_t[s]
+								// diagonale: [r]; piena: [r*M+s] solo per s>=r (ordine 2)
+};
+
+
+// Aree di lavoro dell'E-step di una sequenza, una per thread. Sono dimensionate sulla
+// sequenza piu' lunga vista finora e riusate per tutte le sequenze e le iterazioni:
+// durante il training non si alloca piu' niente per sequenza e la memoria occupata
+// dipende solo da thread e lunghezza massima, non dal numero di sequenze.
+// Vengono liberate con il workspace (alla fine di BaumWelch_Multiple/BaumWelch_Stream).
+class CBaumWelchWorkspace{
+public:
+	CBaumWelchWorkspace(): m_iT(0), m_iN(0), m_iK(0), m_iM(0), m_bPacked(false) {}
+
+	// spazio per sequenze lunghe fino a T; rialloca solo se T cresce o cambia il modello
+	void Reserve(unsigned int T, unsigned int N, unsigned int K, unsigned int M);
+
+	// copia i parametri delle GMM degli stati in m_packed (una volta per passata di EM, sul
+	// thread chiamante: Pack aggiorna le inverse). m_bPacked = false se non sono diagonali
+	void PackStates(vector<CGMM_tiny> &states);
+
+	unsigned int m_iT, m_iN, m_iK, m_iM;
+	Mat_<double> m_obs;				// (T,M) osservazioni
+	vector<Mat_<double> > m_logLK;	// N x (T,K) log(w_k N_k(O_t)) per stato
+	Mat_<double> m_logB;			// (T,N)
+	Mat_<double> m_logAlpha;		// (T,N)
+	Mat_<double> m_logBeta;			// (T,N)
+	Mat_<double> m_gamma;			// (T,N)
+	Mat_<double> m_xi;				// (T,N,N)
+	vector<double> m_work;			// (max(K, 3N)) appoggio di LogSumExp e di forward/backward/gamma/xi
+	vector<CGMM_packed<double> > m_packed;	// GMM degli stati impacchettate (PackStates)
+	bool m_bPacked;					// m_packed valide per i parametri attuali
+	CBaumWelchStats m_stats;		// statistiche accumulate dal thread
+};
+
+
+// Sorgente di sequenze per il training in streaming (Init_Random_Stream, BaumWelch_Stream):
+// le sequenze vengono lette una alla volta, tipicamente da disco, e la lettura riparte
+// dall'inizio ad ogni passata di EM. In memoria resta solo il blocco che si sta elaborando.
+class CSequenceReader{
+public:
+	virtual ~CSequenceReader() {}
+	// riparte dalla prima sequenza; false se la sorgente non si puo' leggere
+	virtual bool Rewind() = 0;
+	// legge la prossima sequenza in seq (un vector<double> per osservazione, seq viene
+	// riusato per non riallocare); false quando le sequenze sono finite
+	virtual bool Next(vector<vector<double> > &seq) = 0;
+};
+
+
 class CHMM_GMM{
  
 public:
@@ -91,6 +197,14 @@ public:
 	// M: dimension del feature vector
 	// K: numero di gaussiane per ogni B
 	CHMM_GMM (unsigned int N, unsigned  int M, unsigned int K);
+
+	// copia: tutti i parametri vengono duplicati (clone), non condivisi; le aree di
+	// lavoro del training non vengono copiate
+	CHMM_GMM (const CHMM_GMM &ref);
+	CHMM_GMM & operator= (const CHMM_GMM &ref);
+	// move: i parametri passano a questo modello senza copie, ref resta vuoto
+	CHMM_GMM (CHMM_GMM &&ref) GMMSTD_NOEXCEPT;
+	CHMM_GMM & operator= (CHMM_GMM &&ref) GMMSTD_NOEXCEPT;
 	
 	// distruttore --> void FreeHMM(HMM *phmm);
 	~CHMM_GMM(){
@@ -145,6 +259,18 @@ public:
 		return bSet;
 	}
 
+	// thread usati dall'E-step di BaumWelch_Multiple/BaumWelch_Stream (0 = uno per core):
+	// il pool viene creato all'inizio del training e chiuso alla fine
+	void SetTrainingThreads (unsigned int nThreads){
+		m_iTrainingThreads = nThreads;
+	}
+
+	// pool gia' esistente da usare per l'E-step al posto di uno nuovo (NULL = crearlo ad ogni training).
+	// Il training non deve essere chiamato da dentro una parallelFor dello stesso pool.
+	void SetTrainingPool (ThreadPool *pPool){
+		m_pTrainingPool = pPool;
+	}
+
 	
 
 	// versioni senza alfa, beta eccc portate fuori
@@ -155,6 +281,18 @@ public:
 	template <class ForwardIterator1, class ForwardIterator2>
 	double ForwardWithScale(ForwardIterator1 ObservationsBegin, ForwardIterator1 ObservationsEnd, Mat_<double> &alpha, ForwardIterator2 ScaleBegin);
 
+	// come sopra, ma con le emissioni gia' calcolate: logB(t,j) = log b_j(O_t) (vedi ComputeLogEmissions)
+	template <class ForwardIterator2>
+	double ForwardWithScale(const Mat_<double> &logB, Mat_<double> &alpha, ForwardIterator2 ScaleBegin);
+
+	// forward incrementale: stessi conti di ForwardLog, ma una osservazione alla volta.
+	// ForwardReset azzera lo stato, ForwardStep aggiunge un'osservazione e
+	// restituisce il log likelihood della sequenza vista fino a quel momento.
+	void ForwardReset(CForwardState &state) const;
+	double ForwardStep(CForwardState &state, const vector<double> &observation);
+	// versione con le emissioni del frame gia' calcolate: logB[j] = log b_j(O_t)
+	double ForwardStep(CForwardState &state, const double *logB) const;
+
 	// backward
 	template <class ForwardIterator>
 	double Backward(ForwardIterator ObservationsBegin, ForwardIterator ObservationsEnd);
@@ -162,6 +300,28 @@ public:
 	template <class BidirectionalIterator1, class BidirectionalIterator2>
 	double BackwardWithScale(BidirectionalIterator1 ObservationsBegin, BidirectionalIterator1 ObservationsEnd, Mat_<double> &beta,  BidirectionalIterator2 ScaleBegin);
 
+	template <class BidirectionalIterator2>
+	double BackwardWithScale(const Mat_<double> &logB, Mat_<double> &beta,  BidirectionalIterator2 ScaleBegin);
+
+	// forward e backward nel dominio dei logaritmi: logAlpha(t,j) = log alpha(t,j) e
+	// logBeta(t,i) = log beta(t,i), senza scale. Le emissioni restano in log (nessun exp(logB))
+	// e ogni passo e' una log-sum-exp sugli stati: N exp (vettoriali) e N log per osservazione,
+	// quindi niente underflow (ne' assert sulla scala) anche su sequenze lunghe o con
+	// emissioni molto piccole. Ritornano log P(O|modello).
+	// work: 3N double di appoggio (NULL = allocati ad ogni chiamata)
+	double ForwardLog(const Mat_<double> &logB, Mat_<double> &logAlpha, double *work = NULL);
+	double BackwardLog(const Mat_<double> &logB, Mat_<double> &logBeta, double *work = NULL);
+
+	template <class ForwardIterator>
+	double ForwardLog(ForwardIterator ObservationsBegin, ForwardIterator ObservationsEnd, Mat_<double> &logAlpha);
+
+	// cache delle emissioni: logB(t,j) = log b_j(O_t) per ogni osservazione e ogni stato.
+	// Le GMM si valutano una volta sola per frame e la tabella e' poi usata da forward, backward e xi.
+	template <class ForwardIterator>
+	void ComputeLogEmissions(ForwardIterator ObservationsBegin, ForwardIterator ObservationsEnd, Mat_<double> &logB);
+	// una sola osservazione: logB[j] per j=0..N-1
+	void ComputeLogEmissions(const vector<double> &observation, double *logB, bool bRecalc=false);
+
 	
 
 //void CHMM_GMM::BaumWelch(const CArray<CArray<double>*> &O, CArray2D<double> &alpha, CArray2D<double> &beta,
@@ -200,6 +360,13 @@ public:
 	template <class BidirectionalIterator>
 	void BaumWelch_Multiple(BidirectionalIterator FirstSequence, BidirectionalIterator LastSequence, int *pniter, double *plogprobinit, double *plogprobfinal);
 
+	// come Init_Random_Multiple e BaumWelch_Multiple, ma leggendo le sequenze da reader ad ogni
+	// passata, nSequences alla volta: in memoria restano solo quel blocco e le statistiche
+	// sufficienti, quindi il training set puo' essere piu' grande della RAM.
+	// Ritornano false se reader non si legge o non ha sequenze.
+	bool Init_Random_Stream(CSequenceReader &reader);
+	bool BaumWelch_Stream(CSequenceReader &reader, unsigned int nSequences, int *pniter, double *plogprobinit, double *plogprobfinal);
+
 
 	// Funzioni di utilit
 	
@@ -209,14 +376,37 @@ public:
 	template <class BidirectionalIterator>
 		void ComputeXi(BidirectionalIterator FirstObservation, BidirectionalIterator LastObservation, Mat_<double> &alpha, Mat_<double> &beta, Mat_<double> &xi);
 
-	template <class  BidirectionalIterator>
-		void UpdateSigmaNumDen(BidirectionalIterator FirstObservation, BidirectionalIterator LastObservation, double &dNum_sigmail, double &dDen_sigmail, int e, int i, int r, int s, int k);
+	void ComputeXi(const Mat_<double> &logB, Mat_<double> &alpha, Mat_<double> &beta, Mat_<double> &xi);
+
+	// gamma e xi a partire da logAlpha e logBeta (ForwardLog/BackwardLog); work come sopra
+	void ComputeGammaLog(const Mat_<double> &logAlpha, const Mat_<double> &logBeta, Mat_<double> &gamma, double *work = NULL);
+	void ComputeXiLog(const Mat_<double> &logB, const Mat_<double> &logAlpha, const Mat_<double> &logBeta, Mat_<double> &xi, double *work = NULL);
 
-		template <class  BidirectionalIterator>
-	void  UpdateMuilNumDen(BidirectionalIterator FirstObservation, BidirectionalIterator LastObservation, double &dNum_muil, double &dDen_muil, int e, int r, int k);
+	// E-step di BaumWelch_Multiple su tutte le sequenze, diviso tra i thread:
+	// statistiche sufficienti di pi, A e delle gaussiane in stats
+	// (workspaces: uno per thread di pool, creati qui la prima volta e riusati alle chiamate successive).
+	// Con bNewParameters le GMM vengono reimpacchettate in tutti i workspace; altrimenti
+	// (blocchi successivi della stessa passata, vedi EStep_Stream) solo nei workspace nuovi.
+	template <class BidirectionalIterator>
+	void EStep_Multiple(BidirectionalIterator FirstSequence, BidirectionalIterator LastSequence, CBaumWelchStats &stats, vector<CBaumWelchWorkspace> &workspaces, ThreadPool &pool, bool bNewParameters = true);
+
+	// E-step di una sequenza: accumula in stats (di un solo thread) con un solo passaggio sulle osservazioni
+	template <class BidirectionalIterator>
+	void EStep_Sequence(BidirectionalIterator FirstObservation, BidirectionalIterator LastObservation, CBaumWelchWorkspace &ws, CBaumWelchStats &stats);
 
-	template <class  BidirectionalIterator>
-	void UpdateGammail(BidirectionalIterator FirstObservation, BidirectionalIterator LastObservation, int e, int i);
+	// M-step: nuovi pi, A e GMM dalle statistiche sufficienti (E = numero di sequenze)
+	void MStep(const CBaumWelchStats &stats, unsigned int E);
+
+	// E-step di BaumWelch_Stream: una passata su reader, nSequences sequenze alla volta;
+	// E = numero di sequenze lette
+	bool EStep_Stream(CSequenceReader &reader, unsigned int nSequences, CBaumWelchStats &stats, unsigned int &E, vector<CBaumWelchWorkspace> &workspaces, ThreadPool &pool);
+
+	// parte comune di Init_Random_Multiple e Init_Random_Stream: means e Sqrtvariance sono le
+	// somme delle osservazioni e dei loro quadrati, T il numero di osservazioni, E delle sequenze
+	bool Init_Random_Moments(vector<double> &means, vector<double> &Sqrtvariance, double T, int E, double SumOfSquareT);
+
+	// pool dell'E-step: m_pTrainingPool, oppure uno nuovo con m_iTrainingThreads thread in ownPool
+	ThreadPool &GetTrainingPool(std::unique_ptr<ThreadPool> &ownPool) const;
 	
 	double GetThreshold() {return m_dThreshold;}
 
@@ -258,11 +448,9 @@ public:
 	bool m_bThreshold_alphat;		// thres was computed considering the final state prob?
 	bool m_bThreshold_length;		// thres was computed considering the statistical duration of the training sequence?
 
-	// per uso interno
-protected:
-	vector<Mat_<double>*> Vp_xi; // (T,m_iN,m_iN);
-	vector<Mat_<double>*> Vp_gammail; // (T,m_iK);
-	vector<Mat_<double>*> Vp_gamma; // (T,m_iK);
+	unsigned int m_iTrainingThreads;	// thread dell'E-step di BaumWelch_Multiple (0 = uno per core)
+	ThreadPool *m_pTrainingPool;		// pool dell'E-step dato da fuori (NULL = creato dal training)
+
 
 
 	};
@@ -479,16 +667,16 @@ protected:
 	
 		int T;
 		T= SequenceLength(ObservationsBegin,ObservationsEnd);
-		Mat_<double> alpha(T,m_iN);
-		vector<double> scale (T,1);
+		Mat_<double> logAlpha(T,m_iN);
 		double logprobf;
-		logprobf = ForwardWithScale(ObservationsBegin, ObservationsEnd,alpha, scale.begin());
+		logprobf = ForwardLog(ObservationsBegin, ObservationsEnd, logAlpha);
 		if(alphaT)
 		{
-			if(alphaT->rows==1 && alphaT->cols==m_iN)
-				alpha.row(T-1).copyTo(*alphaT);
-			else
-				*alphaT=alpha.row(T-1).clone();
+			// alpha(T-1,:) normalizzati, come quelli di ForwardWithScale
+			if(alphaT->rows!=1 || alphaT->cols!=m_iN)
+				alphaT->create(1,m_iN);
+			for (unsigned int i=0; i<m_iN; i++)
+				(*alphaT)(0,i) = exp(logAlpha(T-1,i) - logprobf);
 		}
 		return logprobf;
 	}
@@ -513,35 +701,6 @@ protected:
 	template <class BidirectionalIterator>
 	bool CHMM_GMM::Init_Random_Multiple(BidirectionalIterator FirstSequence, BidirectionalIterator LastSequence)
 	{
-		// probabilit iniziali
-		int i,j;
-		double dVal,dSum=0;
-
-
-		if (m_bLeftRight){
-			// prob iniziale
-			fill(m_pi.begin(),m_pi.end(), 0);
-			m_pi(0,0)=1.0;
-			//matrice A: 
-			fill(m_A.begin(),m_A.end(),0.); 
-			for (i=0; i<m_iN-1; i++){
-				m_A(i,i)=0.5;
-				m_A(i,i+1)=0.5;
-			}
-			m_A(m_iN-1,m_iN-1)=1;
-		}
-
-		else
-		{   // prob iniz
-			fill(m_pi.begin(),m_pi.end(), 1.0/m_iN);
-			//matrice A: 0.6 sulla diagonale, 0.4/(numstates-1) dalle altre parti
-			fill(m_A.begin(),m_A.end(), 0.4/(m_iN-1));
-			for (i=0; i<m_iN; i++)
-				m_A(i,i)=0.6;
-
-		}
-
-		
 		// matrice B: distribuzioni random ma comprese tra valori compatibili con le osservazioni
 		vector<double> means (m_iM,0.);
 		vector<double> Sqrtvariance (m_iM,0.);
@@ -562,43 +721,7 @@ protected:
 			E++;
 		}
 
-		
-		// calcolo varianze e medie vere
-		for (i=0; i<m_iM; i++)
-			{
-				means[i]/=T; // T*E;
-				Sqrtvariance[i]=3.0*sqrt((Sqrtvariance[i]/T)- (means[i]*means[i]));
-			}
-
-
-		int n,m,k;
-		// ora imposto le gaussiane a normali
-		for (n=0; n<m_iN; n++)
-			for (k=0; k<m_iK; k++)
-				m_B[n].GetGaussian(k).SetToNormal();
-			
-
-		for (n=0; n<m_iN; n++)
-			for (k=0; k<m_iK; k++)
-			{
-				for (m=0; m<m_iM; m++)
-				{
-					// setto valore medio delle gaussiane
-					m_B[n].MeanValue(k,m) = random_Uniform(means[m]-3.0*Sqrtvariance[m],means[m]+3.0*Sqrtvariance[m]);
-					// setto varianza delle gaussiane
-					m_B[n].CoVarianceValue(k,m,m)=(Sqrtvariance[m])*(Sqrtvariance[m]);
-				}
-				// peso uniforme
-				m_B[n].WeightValue(k)=1.0 / m_iK;
-			}
-
-
-		// media e varianza delle lunghezze
-		m_dDurationMean =  T / E;
-		m_dDurationVariance = (SumOfSquareT / E) - (m_dDurationMean *m_dDurationMean);
-
-
-		return true;
+		return Init_Random_Moments(means, Sqrtvariance, T, E, SumOfSquareT);
 	}
 
 
@@ -675,15 +798,43 @@ template <class ForwardIterator1, class ForwardIterator2>
 double CHMM_GMM::ForwardWithScale(ForwardIterator1 ObservationsBegin, ForwardIterator1 ObservationsEnd, Mat_<double> &alpha, ForwardIterator2 ScaleBegin)
 /*  pprob is the LOG probability */
 {
-	unsigned int	i, j; 	/* state indices */
-	unsigned int	t;	/* time index */
-
-	ForwardIterator1 it;
 	// conto il numero di osservazioni presenti
 	unsigned int T=0;
 	T= SequenceLength(ObservationsBegin,ObservationsEnd);
-	
-	//	for (it = ObservationsBegin; it != ObservationsEnd; ++it) T++;
+		
+	if (!T)
+		return 0;  // errore
+
+	// valuto le GMM una volta sola per ogni frame
+	Mat_<double> logB(T,m_iN);
+	ComputeLogEmissions(ObservationsBegin, ObservationsEnd, logB);
+
+	return ForwardWithScale(logB, alpha, ScaleBegin);
+}
+
+
+template <class ForwardIterator>
+double CHMM_GMM::ForwardLog(ForwardIterator ObservationsBegin, ForwardIterator ObservationsEnd, Mat_<double> &logAlpha)
+{
+	unsigned int T = SequenceLength(ObservationsBegin,ObservationsEnd);
+	if (!T)
+		return 0;  // errore
+
+	Mat_<double> logB(T,m_iN);
+	ComputeLogEmissions(ObservationsBegin, ObservationsEnd, logB);
+
+	return ForwardLog(logB, logAlpha);
+}
+
+
+template <class ForwardIterator2>
+double CHMM_GMM::ForwardWithScale(const Mat_<double> &logB, Mat_<double> &alpha, ForwardIterator2 ScaleBegin)
+/*  pprob is the LOG probability */
+{
+	unsigned int	i, j; 	/* state indices */
+	unsigned int	t;	/* time index */
+
+	unsigned int T=logB.rows;
 		
 	if (!T)
 		return 0;  // errore
@@ -695,12 +846,11 @@ double CHMM_GMM::ForwardWithScale(ForwardIterator1 ObservationsBegin, ForwardIte
 	double dScale;
 
 	/* 1. Initialization */
-	it = ObservationsBegin;
 	t=0;
 	dScale = 0;
 	for (i = 0; i < m_iN; i++) {
 		//alpha(0,i) = m_pi[i]* (m_B(i,O[0]));
-		dBiO = m_B[i].GetLikelihood(*it);
+		dBiO = exp(logB(0,i));
 		alpha(0,i) = m_pi(i,0)* dBiO;
 		dScale  += alpha(0,i);
 	}
@@ -719,9 +869,7 @@ double CHMM_GMM::ForwardWithScale(ForwardIterator1 ObservationsBegin, ForwardIte
 	dprob += log(dScale);
 	
 	/* 2. Induction */
-	++t;
-	++it;
-    for (; it != ObservationsEnd; ++it, t++){
+    for (t=1; t < T; t++){
 
 		dScale = 0.0;
 		for (j = 0; j < m_iN; j++) {
@@ -730,7 +878,7 @@ double CHMM_GMM::ForwardWithScale(ForwardIterator1 ObservationsBegin, ForwardIte
 				sum += alpha(t-1,i)* (m_A(i,j)); 
 
 			//alpha(t+1,j) = sum*(m_B(j,O[t+1]));
-			dBjO = m_B[j].GetLikelihood(*it,false);
+			dBjO = exp(logB(t,j));
 			alpha(t,j) = sum * dBjO;
 
 			dScale += alpha(t,j);
@@ -758,6 +906,31 @@ double CHMM_GMM::ForwardWithScale(ForwardIterator1 ObservationsBegin, ForwardIte
 }
 
 
+// tabella T x N delle emissioni di una sequenza: le osservazioni vengono copiate in un
+// blocco contiguo T x M e ogni stato le valuta tutte insieme (GetLogLikelihood_batch)
+template <class ForwardIterator>
+void CHMM_GMM::ComputeLogEmissions(ForwardIterator ObservationsBegin, ForwardIterator ObservationsEnd, Mat_<double> &logB)
+{
+	unsigned int t, j, m;
+	unsigned int T = (unsigned int)distance(ObservationsBegin, ObservationsEnd);
+	if (T==0)
+		return;
+
+	Mat_<double> obs (T, m_iM);
+	t=0;
+	for (ForwardIterator it = ObservationsBegin; it != ObservationsEnd; ++it, ++t)
+		for (m = 0; m < m_iM; m++)
+			obs(t,m) = (*it)[m];
+
+	Mat_<double> logBj;
+	for (j = 0; j < m_iN; j++){
+		m_B[j].GetLogLikelihood_batch(obs, logBj);
+		for (t = 0; t < T; t++)
+			logB(t,j) = logBj(t,0);
+	}
+}
+
+
 // ----------------------------------------------
 // ----------------------------------------------
 // ----------------------------------------------
@@ -817,6 +990,20 @@ double CHMM_GMM::Backward(BackwardIterator ObservationsBegin, BackwardIterator O
 //double  CHMM_GMM::BackwardWithScale(const CArray<CArray<double>*> &O, CArray2D<double> &beta,CArray<double> &scale)
 template <class BidirectionalIterator1, class BidirectionalIterator2>
 	double CHMM_GMM::BackwardWithScale(BidirectionalIterator1 ObservationsBegin, BidirectionalIterator1 ObservationsEnd, Mat_<double> &beta, BidirectionalIterator2 ScaleBegin)
+{
+	unsigned int T;
+	T = SequenceLength(ObservationsBegin,ObservationsEnd);
+
+	// valuto le GMM una volta sola per ogni frame (prima venivano rivalutate per ogni stato di partenza)
+	Mat_<double> logB(T,m_iN);
+	ComputeLogEmissions(ObservationsBegin, ObservationsEnd, logB);
+
+	return BackwardWithScale(logB, beta, ScaleBegin);
+}
+
+
+template <class BidirectionalIterator2>
+	double CHMM_GMM::BackwardWithScale(const Mat_<double> &logB, Mat_<double> &beta, BidirectionalIterator2 ScaleBegin)
 {
     unsigned int     i, j;   /* state indices */
     int     t;      /* time index */
@@ -827,10 +1014,9 @@ template <class BidirectionalIterator1, class BidirectionalIterator2>
 
 	
 	unsigned int T;
-	T = SequenceLength(ObservationsBegin,ObservationsEnd);
+	T = logB.rows;
 
 	BidirectionalIterator2 scale = ScaleBegin+T-1;
-	BidirectionalIterator1 it;
 	
 
 	/* 1. Initialization */
@@ -842,14 +1028,9 @@ template <class BidirectionalIterator1, class BidirectionalIterator2>
  
         /* 2. Induction */
 	
-	
-	// parto dall'ultimo valore valido
-  it = ObservationsEnd;
-
     
   for (t=T-2; t>=0; --t ){
 
-	   --it;
 		--scale;
 
 		dScale = *scale;
@@ -857,7 +1038,7 @@ template <class BidirectionalIterator1, class BidirectionalIterator2>
          for (i = 0; i < m_iN; i++) {
 			sum = 0.0;
 			for (j = 0; j < m_iN; j++){
-				dBjO = m_B[j].GetLikelihood(*it,false);
+				dBjO = exp(logB(t+1,j));
 				//sum += m_A(i,j) * (m_B(j,O[t+1]))*beta(t+1,j);
 				sum += m_A(i,j) * dBjO *beta(t+1,j);
 			}
@@ -872,9 +1053,6 @@ template <class BidirectionalIterator1, class BidirectionalIterator2>
     	
 	return dProb;
 
-
-
- 
 }
 
 
@@ -895,8 +1073,7 @@ template <class BidirectionalIterator1, class BidirectionalIterator2>
 	void CHMM_GMM::BaumWelch_Multiple(BidirectionalIterator FirstSequence, BidirectionalIterator LastSequence, int *pniter, double *plogprobinit, double *plogprobfinal)
 {
 	
-	unsigned int	e,i, j, k;
-	unsigned int	t, l = 0;
+	unsigned int	l = 0;
 
 	// leggo il numero di osservazioni
 	unsigned int E;
@@ -905,93 +1082,27 @@ template <class BidirectionalIterator1, class BidirectionalIterator2>
 	
 	unsigned int T;
 	// non esiste un T fisso...
-	//	T= O.GetSize();
-
-	double dOld, dNew;
-
-	double	logprobf, logprobb;
-	double	numeratorA, denominatorA;
-
-	Vp_xi.clear();
-	Vp_gammail.clear();
-	Vp_gamma.clear();
-
-	//CArray<CArray<double>*> Vp_scale (0); // (T);
 
-	// creo le aree dati
-	//for (e=0; e<E; e++)
-	e=0;
-	for (BidirectionalIterator itSeq=FirstSequence; itSeq != LastSequence; ++itSeq, ++e)
-	{
-
-		T= SequenceLength((*itSeq).begin(),(*itSeq).end());
-		
-		int iSize[] = {T,m_iN,m_iN};
-		Mat_<double>* p_xi  = new Mat_<double> (3,iSize);
-		Vp_xi.push_back(p_xi);
-
-		Mat_<double>* p_gamma  = new Mat_<double> (T,m_iN);
-		Vp_gamma.push_back(p_gamma);
-
-		Mat_<double>* p_gammail  = new Mat_<double> (T,m_iK);
-		Vp_gammail.push_back(p_gammail);
-
-	
-	}
-
-	
-
-	double delta, deltaprev, logprobprev;
-	deltaprev = 10e-70;
-
-	
-
-	// INIT - calcolo valori iniziali
-	*plogprobinit =0;
+	// media e varianza delle lunghezze
 	double dSumOfT, dSumofSquareT;
 	dSumOfT = 0;
 	dSumofSquareT=0;
-	//for (e=0; e<E; e++)
-	e=0;
-	for (BidirectionalIterator itSeq=FirstSequence; itSeq != LastSequence; ++itSeq, ++e)
+	for (BidirectionalIterator itSeq=FirstSequence; itSeq != LastSequence; ++itSeq)
 	{
-		
-		//CArray<CArray<double>*> & O = *SetofO[e];
 		T= SequenceLength((*itSeq).begin(),(*itSeq).end());
 		dSumOfT+=T;
 		dSumofSquareT+= T*T;
+	}
 
-		// alpha, beta e scale non devo conservarli e sono dipendenti da T. 
-		Mat_<double> alpha(T,m_iN);
-		Mat_<double> beta(T,m_iN);
-		vector<double> scale (T);
-				
-		// recupero gamma e xi correnti
-		Mat_<double> & gamma = *Vp_gamma[e];
-		Mat_<double> & xi= *Vp_xi [e];
-
-		logprobf = ForwardWithScale( (*itSeq).begin(),(*itSeq).end(), alpha, scale.begin());
-		logprobb = BackwardWithScale( (*itSeq).begin(),(*itSeq).end(), beta, scale.begin());
-		ComputeGamma(alpha, beta, gamma);
-		ComputeXi((*itSeq).begin(),(*itSeq).end(), alpha, beta, xi);
-		(*plogprobinit)+=logprobf;
-
-		// CONTROLLO CORRETTEZZA GAMMA E XI
-		for (int t1 = 0; t1<T; t1++)
-		{
-			double dSumxij=0;
-			for (int i = 0; i<m_iN; i++)
-			{
-				for (int j = 0; j<m_iN; j++)
-				{
-					dSumxij+= xi(t1,i,j);
-				}
-			}
-
-				
-		}
+	double delta, logprobprev;
 
-	}
+	// INIT - calcolo valori iniziali
+	CBaumWelchStats stats;
+	vector<CBaumWelchWorkspace> workspaces;
+	std::unique_ptr<ThreadPool> ownPool;
+	ThreadPool &pool = GetTrainingPool(ownPool);
+	EStep_Multiple(FirstSequence, LastSequence, stats, workspaces, pool);
+	*plogprobinit = stats.m_dLogProb;
 
 	logprobprev = *plogprobinit;
 
@@ -1001,190 +1112,13 @@ template <class BidirectionalIterator1, class BidirectionalIterator2>
 
 	do  {	
 
-		// reestimate frequency of state i in time t=1 
-		for (i = 0; i < m_iN; i++) {
-			double dVal;
-			dVal = 0;
-			for (e = 0; e < E; e++){
-				Mat_<double> & gamma = *Vp_gamma[e];
-				dVal+= gamma(0,i);
-			}
-			dVal /= E;
-			//m_pi(i,0) = (DELTA / m_iN) + (1.0-DELTA) * dVal;  // fattore DELTA per evitare di avere 0 
-			m_pi(i,0) = dVal;  
-		}
-
-		
-
-		// reestimate transition matrix and symbol prob in each state 
-		for (i = 0; i < m_iN; i++) { 
-
-			
-			// CALCOLO IL DENOMINATORE, CHE  COMUNE A TUTTI
-			denominatorA = 0.0;
-			for (e = 0; e < E; e++){
-				Mat_<double> & gamma = *Vp_gamma[e];
-				T= gamma.rows;
-				for (t = 0; t < T - 1; t++) 
-					denominatorA += gamma(t,i);
-			}
-
-			//aggiorno Aij
-			double dSummmm=0;
-			for (j = 0; j < m_iN; j++) {
-				numeratorA = 0.0;
-				for (e = 0; e < E; e++){
-					Mat_<double> & xi = *Vp_xi[e];
-					T= xi.size[0];
-					for (t = 0; t < T - 1; t++) 
-						numeratorA += xi(t,i,j);
-				}
-			
-				// BUG: ora dovrebbero sommare ad 1
-				//m_A(i,j) = (DELTA / m_iN) + (1.0-DELTA) *numeratorA/denominatorA;
-				if (denominatorA)
-					m_A(i,j) = numeratorA/denominatorA;
-				else
-					m_A(i,j) =0;
-
-				dSummmm+=m_A(i,j);
-			}
-
-			// rinormalizzo A affinch sia stocastica
-			assert(fabs(dSummmm-1)<.001);
-			if (fabs(dSummmm-1)>.001)
-				for (j = 0; j < m_iN; j++) {
-					m_A(i,j) /= dSummmm;
-				}
-
-
-
-			// formule sul paper
-			// calcolo i gammail-esimi (log)
-			//for (e = 0; e < E; e++){
-			e=0;
-			for (BidirectionalIterator itSeq=FirstSequence; itSeq != LastSequence; ++itSeq, ++e)
-			{
-
-				UpdateGammail((*itSeq).begin(),(*itSeq).end(),e,i);
-
-			}
-
-
-			//update di cil, muil, sigmail
-			double dNum_cil;
-			
-			// cil (ovvero i m_B[i].WeightValue(k))
-			// denominatore  lo stesso di denominatorA, quindi non lo ricalcolo
-			for (k = 0; k < m_iK; k++){
-				dNum_cil = 0;
-				// sommo anche in E
-				for (e = 0; e < E; e++){
-					Mat_<double> & gammail = *Vp_gammail[e];
-					T= gammail.rows;
-					for (t = 0; t < T; t++){
-						dNum_cil+= gammail(t,k);
-					}
-				}
-				dOld = m_B[i].WeightValue(k);
-				dNew = dNum_cil / denominatorA;
-				m_B[i].WeightValue(k)=dNew;
-			}
-
-
-			//muil
-			unsigned int r,s;
-			double dNum_muil,dDen_muil;
-			for (k = 0; k < m_iK; k++){  // for each gaussian
-				for (r=0; r< m_iM; r++){  // for each coordinate
-					dNum_muil = 0;
-					dDen_muil = 0;
-					e=0;
-					for (BidirectionalIterator itSeq=FirstSequence; itSeq != LastSequence; ++itSeq)
-					{
-						//for (t = 0; t < T; t++){  // for each t
-						UpdateMuilNumDen((*itSeq).begin(),(*itSeq).end(),dNum_muil,dDen_muil,e,r,k);
-						e++;
-						
-					}
-					dOld = m_B[i].MeanValue(k,r);
-					dNew = dNum_muil / dDen_muil;
-					m_B[i].MeanValue(k,r)=dNew;
-				}
-			}
-
-
-			//sigmail
-			double dNum_sigmail,dDen_sigmail;
-			for (k = 0; k < m_iK; k++){  // for each gaussian
-				for (r=0; r< m_iM; r++){  // for each coordinate
-						for (s=0; s< m_iM; s++){  // for each coordinate
-							dNum_sigmail = 0;
-							dDen_sigmail = 0;
-							//	for (e = 0; e < E; e++){
-							e=0;
-							for (BidirectionalIterator itSeq=FirstSequence; itSeq != LastSequence; ++itSeq)
-							{
-								//CArray<CArray<double>*> & O = *SetofO[e];
-								//T= gammail.GetSizeX();
-								//for (t = 0; t < T; t++){  // for each t
-								UpdateSigmaNumDen((*itSeq).begin(),(*itSeq).end(),dNum_sigmail,dDen_sigmail,e,i,r,s,k);
-								e++;
-									
-							}
-
-							// TODO: Controllare vincoli per evitare che sia singolare la matrice!!!
-
-							dOld=m_B[i].CoVarianceValue(k,r,s);
-							if (r!=s) {
-								if ((dNum_sigmail <= DELTA*dDen_sigmail)|| (m_bDiagonalCovariance))
-									m_B[i].CoVarianceValue(k,r,s)=0;
-								else
-									m_B[i].CoVarianceValue(k,r,s)= dNum_sigmail / dDen_sigmail;
-							}
-							else{  /// sulla diagonale
-								if (dNum_sigmail <= DELTA*dDen_sigmail)
-									m_B[i].CoVarianceValue(k,r,s)=DELTA;
-								else
-									m_B[i].CoVarianceValue(k,r,s)= dNum_sigmail / dDen_sigmail;
-							}
-
-					}
-				}
-				// ricalcolo le inverse
-				m_B[i].GetGaussian(k).InverseRecalc();
-			}
-			
-		}
+		// nuovi parametri dalle statistiche accumulate
+		MStep(stats, E);
 
 		// devo rifare i calcoli
 		double logprobfinale;
-		logprobfinale = 0;
-		e=0;
-		for (BidirectionalIterator itSeq=FirstSequence; itSeq != LastSequence; ++itSeq, ++e)
-		{
-		
-			//CArray<CArray<double>*> & O = *SetofO[e];
-			T= SequenceLength((*itSeq).begin(),(*itSeq).end());
-
-			
-			// alpha, beta e scale non devo conservarli e sono dipendenti da T. 
-			Mat_<double> alpha(T,m_iN);
-			Mat_<double> beta(T,m_iN);
-			vector<double> scale (T);
-			
-
-			Mat_<double> & gamma = *Vp_gamma[e];
-			Mat_<double> & xi= *Vp_xi [e];
-			
-
-			logprobf = ForwardWithScale( (*itSeq).begin(),(*itSeq).end(), alpha, scale.begin());
-			logprobb = BackwardWithScale( (*itSeq).begin(),(*itSeq).end(), beta, scale.begin());
-			ComputeGamma(alpha, beta, gamma);
-			ComputeXi((*itSeq).begin(),(*itSeq).end(), alpha, beta, xi);
-			logprobfinale+=logprobf;
-
-		}
+		EStep_Multiple(FirstSequence, LastSequence, stats, workspaces, pool);
+		logprobfinale = stats.m_dLogProb;
 						
 		// compute difference between log probability of  two iterations 
 		delta = fabs(logprobfinale - logprobprev); 
@@ -1200,64 +1134,138 @@ template <class BidirectionalIterator1, class BidirectionalIterator2>
 	// media e varianza delle lunghezze
 		m_dDurationMean = dSumOfT / E;
 		m_dDurationVariance = (dSumofSquareT / E) - (m_dDurationMean *m_dDurationMean);
-
 }
 
 
 
-template <class  BidirectionalIterator>
-void  CHMM_GMM::UpdateSigmaNumDen(BidirectionalIterator FirstObservation, BidirectionalIterator LastObservation, double &dNum_sigmail, double &dDen_sigmail, int e, int i,  int r, int s, int k)
+template <class BidirectionalIterator>
+void CHMM_GMM::EStep_Multiple(BidirectionalIterator FirstSequence, BidirectionalIterator LastSequence, CBaumWelchStats &stats, vector<CBaumWelchWorkspace> &workspaces, ThreadPool &pool, bool bNewParameters)
 {
-	int t;
-	t=0;
-	Mat_<double> & gammail = *Vp_gammail[e];
-	for (BidirectionalIterator itObs = FirstObservation; itObs  != LastObservation; ++itObs)
-		{
-			dNum_sigmail+= gammail(t,k) * ((*itObs)[r] -m_B[i].MeanValue(k,r))*((*itObs)[s]-m_B[i].MeanValue(k,s));
-			dDen_sigmail+= gammail(t,k);
-			t++;
-		}
+	// accesso diretto alla e-esima sequenza
+	vector<BidirectionalIterator> seqs;
+	unsigned int Tmax = 0;
+	for (BidirectionalIterator itSeq=FirstSequence; itSeq != LastSequence; ++itSeq){
+		seqs.push_back(itSeq);
+		Tmax = max(Tmax, (unsigned int)SequenceLength((*itSeq).begin(), (*itSeq).end()));
+	}
+	unsigned int E = (unsigned int)seqs.size();
+
+	// un workspace (e un accumulatore) per thread del pool
+	unsigned int nThreads = pool.size();
+	if (workspaces.size() < nThreads)
+		workspaces.resize(nThreads);
+
+	// inverse delle covarianze e GMM impacchettate aggiornate qui, una volta per passata:
+	// nei thread le GMM vengono solo lette
+	if (bNewParameters)
+		for (unsigned int j = 0; j < m_iN; j++)
+			m_B[j].UpdateInverse();
+	for (unsigned int b = 0; b < nThreads; b++)
+		if (bNewParameters || workspaces[b].m_packed.size() != m_iN)
+			workspaces[b].PackStates(m_B);
+	for (unsigned int b = 0; b < nThreads; b++)
+		workspaces[b].m_stats.Reset(m_iN, m_iK, m_iM, m_bDiagonalCovariance);
+
+	// una sequenza per blocco: ogni thread prende la prossima appena ha finito la sua, quindi
+	// sequenze di lunghezza diversa non lasciano thread fermi
+	pool.parallelFor(E, [&](size_t first, size_t last){
+		CBaumWelchWorkspace &ws = workspaces[pool.threadIndex()];
+		ws.Reserve(Tmax, m_iN, m_iK, m_iM);
+		for (size_t e = first; e < last; e++)
+			EStep_Sequence((*seqs[e]).begin(), (*seqs[e]).end(), ws, ws.m_stats);
+	}, 1);
+
+	stats.Reset(m_iN, m_iK, m_iM, m_bDiagonalCovariance);
+	for (unsigned int b = 0; b < nThreads; b++)
+		stats.Add(workspaces[b].m_stats);
 }
 
-template <class  BidirectionalIterator>
-void  CHMM_GMM::UpdateMuilNumDen(BidirectionalIterator FirstObservation, BidirectionalIterator LastObservation, double &dNum_muil, double &dDen_muil, int e, int r, int k)
+
+template <class BidirectionalIterator>
+void CHMM_GMM::EStep_Sequence(BidirectionalIterator FirstObservation, BidirectionalIterator LastObservation, CBaumWelchWorkspace &ws, CBaumWelchStats &stats)
 {
-	int t;
-	t=0;
-	Mat_<double> & gammail = *Vp_gammail[e];
+	unsigned int i, j, k, t, r, s;
+	unsigned int T = SequenceLength(FirstObservation, LastObservation);
+	if (!T)
+		return;
+	const unsigned int M = m_iM;
 
-	for (BidirectionalIterator itObs = FirstObservation; itObs  != LastObservation; ++itObs)
-		{
-			dNum_muil+= gammail(t,k) * ((*itObs) [r]);
-			dDen_muil+= gammail(t,k);
-			t++;
-		}
-}
+	// le matrici qui sotto sono viste sulle prime T righe del workspace: nessuna allocazione
+	ws.Reserve(T, m_iN, m_iK, m_iM);
 
+	// osservazioni in un blocco contiguo T x M
+	Mat_<double> obs = ws.m_obs.rowRange(0,T);
+	t=0;
+	for (BidirectionalIterator itObs = FirstObservation; itObs != LastObservation; ++itObs, ++t)
+		for (r = 0; r < M; r++)
+			obs(t,r) = (*itObs)[r];
+
+	// ws.m_logLK[j](t,k) = log(w_k N_k(O_t)) delle gaussiane dello stato j: le emissioni sono la loro
+	// log-sum-exp e le stesse tabelle danno le responsabilita' delle gaussiane
+	Mat_<double> logB = ws.m_logB.rowRange(0,T);
+	for (j = 0; j < m_iN; j++){
+		Mat_<double> logLK = ws.m_logLK[j].rowRange(0,T);
+		if (ws.m_bPacked)
+			ws.m_packed[j].ComponentLogLikelihoods(obs[0], (int)T, (int)(obs.step[0]/sizeof(double)), logLK[0], (int)(logLK.step[0]/sizeof(double)));
+		else
+			m_B[j].GetComponentLogLikelihoods(obs, logLK);
+		for (t = 0; t < T; t++)
+			logB(t,j) = (m_iK==1) ? logLK(t,0) : LogSumExp(&logLK(t,0), m_iK, &ws.m_work[0]);
+	}
 
+	// alpha e beta in log; xi e' usata solo nei primi T-1 piani
+	Mat_<double> logAlpha = ws.m_logAlpha.rowRange(0,T);
+	Mat_<double> logBeta = ws.m_logBeta.rowRange(0,T);
+	Mat_<double> gamma = ws.m_gamma.rowRange(0,T);
+	Mat_<double> &xi = ws.m_xi;
+
+	stats.m_dLogProb += ForwardLog(logB, logAlpha, &ws.m_work[0]);
+	BackwardLog(logB, logBeta, &ws.m_work[0]);
+	ComputeGammaLog(logAlpha, logBeta, gamma, &ws.m_work[0]);
+	ComputeXiLog(logB, logAlpha, logBeta, xi, &ws.m_work[0]);
+
+	// pi e A
+	for (i = 0; i < m_iN; i++){
+		stats.m_pi[i] += gamma(0,i);
+		for (t = 0; t + 1 < T; t++)
+			stats.m_gamma[i] += gamma(t,i);
+		for (j = 0; j < m_iN; j++)
+			for (t = 0; t + 1 < T; t++)
+				stats.m_xi[i*m_iN+j] += xi(t,i,j);
+	}
 
-template <class  BidirectionalIterator>
-void CHMM_GMM::UpdateGammail(BidirectionalIterator FirstObservation, BidirectionalIterator LastObservation, int e, int i)
-{
-	Mat_<double> & gamma = *Vp_gamma[e];
-	Mat_<double> & gammail = *Vp_gammail[e];
-
-				//CArray<CArray<double>*> & O = *SetofO[e];
-				//T= gamma.GetSizeX();
-				//for (t = 0; t < T; t++){
-	int t=0;
-	for (BidirectionalIterator itObs = FirstObservation; itObs  != LastObservation; ++itObs, ++t)
-	{
-			double dTerm1;
-			dTerm1 = log(gamma(t,i)) - m_B[i].GetLogLikelihood(*itObs,false);
-			for (int k = 0; k < m_iK; k++)
-			{
-				gammail(t,k) = exp(dTerm1 + log(m_B[i].WeightValue(k)) + (m_B[i].GetLogLikelihood_partial(*itObs,k,false)));
+	// gaussiane: momenti di ordine 0, 1 e 2 pesati con gammail, un aggiornamento di rango 1
+	// per osservazione (solo la diagonale se le covarianze sono diagonali)
+	const unsigned int S = stats.SecondOrderSize();
+	for (i = 0; i < m_iN; i++){
+		for (t = 0; t < T; t++){
+			const double g = gamma(t,i);
+			if (g == 0)
+				continue;
+			const double *x = &obs(t,0);
+			for (k = 0; k < m_iK; k++){
+				const double gk = (m_iK==1) ? g : g * exp(ws.m_logLK[i](t,k) - logB(t,i));
+				const unsigned int c = stats.Component(i,k);
+				double *s1 = &stats.m_sum[c*M];
+				double *s2 = &stats.m_sumSq[c*S];
+				stats.m_occ[c] += gk;
+				for (r = 0; r < M; r++)
+					s1[r] += gk * x[r];
+				if (stats.m_bDiagonal){
+					for (r = 0; r < M; r++)
+						s2[r] += gk * x[r] * x[r];
+				}
+				else{
+					for (r = 0; r < M; r++){
+						const double gx = gk * x[r];
+						for (s = r; s < M; s++)
+							s2[r*M+s] += gx * x[s];
+					}
+				}
 			}
+		}
 	}
 }
-	
-
 
 
 	// --------------------------------------
@@ -1295,17 +1303,21 @@ void CHMM_GMM::BaumWelch (BidirectionalIterator FirstObservation, BidirectionalI
 	double delta, deltaprev, logprobprev;
 	deltaprev = 10e-70;
 
-	logprobf = ForwardWithScale ( FirstObservation,LastObservation, alpha, scale.begin());
+	// emissioni del modello corrente, condivise da forward, backward e xi
+	Mat_<double> logB (T,m_iN);
+	ComputeLogEmissions(FirstObservation, LastObservation, logB);
+
+	logprobf = ForwardWithScale (logB, alpha, scale.begin());
 	*plogprobinit = logprobf; /* log P(O |intial model) */
 
 	//DEBUG cout << "iniziale: " <<logprobf << endl;
 	
-	logprobb = BackwardWithScale( FirstObservation,LastObservation, beta, scale.begin());
+	logprobb = BackwardWithScale(logB, beta, scale.begin());
 
 
 
 	ComputeGamma(alpha, beta, gamma);
-	ComputeXi( FirstObservation, LastObservation, alpha, beta, xi);
+	ComputeXi(logB, alpha, beta, xi);
 
 	logprobprev = logprobf;
 
@@ -1453,7 +1465,7 @@ void CHMM_GMM::BaumWelch (BidirectionalIterator FirstObservation, BidirectionalI
 								dNum_sigmail+= gammail(t,k) * ((*it)[r] -m_B[i].MeanValue(k,r))*((*it)[s]-m_B[i].MeanValue(k,s));
 								dDen_sigmail+= gammail(t,k);
 							}
-							dOld=m_B[i].CoVarianceValue(k,r,s);
+							dOld=m_B[i].GetCoVarianceValue(k,r,s);
 							if (dDen_sigmail){
 								assert (dDen_sigmail);
 								if (r!=s){
@@ -1498,10 +1510,11 @@ void CHMM_GMM::BaumWelch (BidirectionalIterator FirstObservation, BidirectionalI
 		}
 
 
-		logprobf= ForwardWithScale( FirstObservation, LastObservation, alpha, scale.begin());
-		logprobb= BackwardWithScale(FirstObservation, LastObservation, beta, scale.begin());
+		ComputeLogEmissions(FirstObservation, LastObservation, logB);
+		logprobf= ForwardWithScale(logB, alpha, scale.begin());
+		logprobb= BackwardWithScale(logB, beta, scale.begin());
 		ComputeGamma(alpha, beta, gamma);
-		ComputeXi(FirstObservation, LastObservation, alpha, beta, xi);
+		ComputeXi(logB, alpha, beta, xi);
 
 		
 		// provo a fare un decode della sequenza
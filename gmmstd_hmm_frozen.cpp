@@ -0,0 +1,394 @@
+//------------------------------------------------------------------
+//
+// Nome file: hmm_frozen.cpp
+// Contenuto: insieme di CHMM_GMM "congelati" per il testing: tutti i
+//            parametri in un'unica area di memoria contigua e allineata
+//
+//------------------------------------------------------------------
+
+
+#include "gmmstd_hmm_frozen.h"
+#include "gmmstd_gmm_simd.h"
+#include "gmmstd_mapped_file.h"
+
+#include <math.h>
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
+#define FROZEN_ALIGN 8 // double per linea di cache (64 byte)
+
+#define FROZEN_FILE_MAGIC "GMMHMMFS"
+#define FROZEN_FILE_VERSION 3
+#define FROZEN_FILE_ENDIAN 0x01020304
+#define FROZEN_FILE_ALIGN 64 // ogni sezione del file inizia su una linea di cache
+
+namespace gmmstd{
+
+
+// intestazione del file (posizioni in byte dall'inizio del file)
+struct SFrozenFileHeader {
+	char szMagic[8];
+	unsigned int iVersion;
+	unsigned int iEndian; // FROZEN_FILE_ENDIAN scritto in formato nativo
+	unsigned int iModelSize; // sizeof(SModel) e sizeof(SState): il layout deve coincidere
+	unsigned int iStateSize;
+	unsigned int iDimension; // dimensione delle osservazioni di tutti gli stati
+	unsigned int iReserved;
+	unsigned long long iModels;
+	unsigned long long iStates;
+	unsigned long long iArenaSize; // in double
+	unsigned long long iModelsOffset;
+	unsigned long long iStatesOffset;
+	unsigned long long iArenaOffset;
+	unsigned long long iNamesOffset; // iModels coppie (posizione, lunghezza) seguite dai caratteri
+	unsigned long long iSourceOffset; // descrizione dei file da cui sono stati costruiti i modelli
+	unsigned long long iSourceSize;
+	unsigned long long iFileSize;
+};
+
+
+static unsigned long long AlignFileOffset(unsigned long long iOffset)
+{
+	return (iOffset + FROZEN_FILE_ALIGN-1) / FROZEN_FILE_ALIGN * FROZEN_FILE_ALIGN;
+}
+
+
+// true se il blocco di n double in posizione iPos sta tutto nell'arena (senza overflow)
+static bool InArena(unsigned long long iPos, unsigned long long n, unsigned long long iArenaSize)
+{
+	return iPos <= iArenaSize && n <= iArenaSize - iPos;
+}
+
+
+CHMM_GMM_FrozenSet::CHMM_GMM_FrozenSet():
+	m_bBuilt(false), m_pModels(NULL), m_nModels(0), m_pStates(NULL), m_nStates(0), m_pArena(NULL), m_iDimension(0)
+{
+}
+
+
+void CHMM_GMM_FrozenSet::Clear()
+{
+	m_bBuilt = false;
+	m_pModels = NULL;
+	m_nModels = 0;
+	m_pStates = NULL;
+	m_nStates = 0;
+	m_pArena = NULL;
+	m_iDimension = 0;
+	m_models.clear();
+	m_states.clear();
+	m_arena.clear();
+	m_mapped.reset();
+}
+
+
+size_t CHMM_GMM_FrozenSet::Reserve(size_t &iSize, size_t n)
+{
+	size_t iPos = iSize;
+	iSize += (n + FROZEN_ALIGN-1) / FROZEN_ALIGN * FROZEN_ALIGN;
+	return iPos;
+}
+
+
+bool CHMM_GMM_FrozenSet::Build(vector<CHMM_GMM> &models)
+{
+	Clear();
+	m_models.resize(models.size());
+
+	// 1. posizioni dei blocchi
+	size_t iSize = 0;
+	size_t i;
+	unsigned int j, k, m;
+	unsigned int iDimension = models.empty() ? 0 : models[0].m_iM;
+	for (i=0; i<models.size(); i++){
+		CHMM_GMM &hmm = models[i];
+		SModel &mod = m_models[i];
+		mod.iN = hmm.m_iN;
+		mod.iM = hmm.m_iM;
+		// tutti i modelli vengono valutati sullo stesso vettore di feature
+		if (mod.iM != iDimension){
+			Clear();
+			return false;
+		}
+		mod.iA = Reserve(iSize, mod.iN*mod.iN);
+		mod.iLogA = Reserve(iSize, mod.iN*mod.iN);
+		mod.iPi = Reserve(iSize, mod.iN);
+		mod.iLogPi = Reserve(iSize, mod.iN);
+		mod.iFirstState = m_states.size();
+		for (j=0; j<mod.iN; j++){
+			SState st;
+			st.iK = hmm.m_B[j].GetGaussiansNumber();
+			st.iM = hmm.m_B[j].GetSize();
+			if (st.iM != iDimension){
+				Clear();
+				return false;
+			}
+			st.iLogConst = Reserve(iSize, st.iK);
+			st.iWeights = Reserve(iSize, st.iK);
+			st.iMeans = Reserve(iSize, st.iK*st.iM);
+			st.iInvVar = Reserve(iSize, st.iK*st.iM);
+			m_states.push_back(st);
+		}
+	}
+
+	// 2. copia dei parametri
+	m_arena.assign(iSize + FROZEN_ALIGN, 0.);
+	size_t p = (size_t)&m_arena[0];
+	double *base = (double *)((p + FROZEN_ALIGN*sizeof(double)-1) & ~(FROZEN_ALIGN*sizeof(double)-1));
+	for (i=0; i<models.size(); i++){
+		CHMM_GMM &hmm = models[i];
+		const SModel &mod = m_models[i];
+		for (j=0; j<mod.iN; j++){
+			for (k=0; k<mod.iN; k++){
+				base[mod.iA + j*mod.iN + k] = hmm.m_A(j,k);
+				base[mod.iLogA + j*mod.iN + k] = log(hmm.m_A(j,k));
+			}
+			base[mod.iPi + j] = hmm.m_pi(j,0);
+			base[mod.iLogPi + j] = log(hmm.m_pi(j,0));
+		}
+		for (j=0; j<mod.iN; j++){
+			const SState &st = m_states[mod.iFirstState + j];
+			CGMM_tiny &gmm = hmm.m_B[j];
+			for (k=0; k<st.iK; k++){
+				CGaussian &g = gmm.GetGaussian(k);
+				g.UpdateInverse();
+				if (!g.IsDiagonal()){
+					Clear();
+					return false;
+				}
+				base[st.iWeights + k] = gmm.WeightValue(k);
+				base[st.iLogConst + k] = log(gmm.WeightValue(k)) + g.m_dLogNormalizer;
+				for (m=0; m<st.iM; m++){
+					base[st.iMeans + k*st.iM + m] = g.m_means(m,0);
+					base[st.iInvVar + k*st.iM + m] = g.m_InverseVariance(m,0);
+				}
+			}
+		}
+	}
+
+	m_pModels = m_models.empty() ? NULL : &m_models[0];
+	m_nModels = m_models.size();
+	m_pStates = m_states.empty() ? NULL : &m_states[0];
+	m_nStates = m_states.size();
+	m_pArena = base;
+	m_iDimension = iDimension;
+	m_bBuilt = true;
+	return true;
+}
+
+
+bool CHMM_GMM_FrozenSet::CheckTables(const SModel *pModels, size_t nModels, const SState *pStates, size_t nStates,
+	unsigned long long iArenaSize, unsigned int iDimension)
+{
+	// gli stati dei modelli sono consecutivi e nello stesso ordine dei modelli (come in Build):
+	// ComputeLogEmissions e GetEmissionOffset contano su questo
+	unsigned long long iNextState = 0;
+	for (size_t i=0; i<nModels; i++){
+		const SModel &mod = pModels[i];
+		unsigned long long iNN = (unsigned long long)mod.iN*mod.iN;
+		if (mod.iN == 0 || mod.iM != iDimension ||
+			mod.iFirstState != iNextState || mod.iN > nStates - iNextState ||
+			!InArena(mod.iA, iNN, iArenaSize) || !InArena(mod.iLogA, iNN, iArenaSize) ||
+			!InArena(mod.iPi, mod.iN, iArenaSize) || !InArena(mod.iLogPi, mod.iN, iArenaSize))
+			return false;
+		iNextState += mod.iN;
+	}
+	if (iNextState != nStates)
+		return false;
+
+	for (size_t s=0; s<nStates; s++){
+		const SState &st = pStates[s];
+		unsigned long long iKM = (unsigned long long)st.iK*st.iM;
+		if (st.iK == 0 || st.iM != iDimension ||
+			!InArena(st.iLogConst, st.iK, iArenaSize) || !InArena(st.iWeights, st.iK, iArenaSize) ||
+			!InArena(st.iMeans, iKM, iArenaSize) || !InArena(st.iInvVar, iKM, iArenaSize))
+			return false;
+	}
+	return true;
+}
+
+
+// scrive size byte in posizione offset (riempiendo di zeri dalla posizione corrente iPos)
+static bool WriteAt(FILE *f, unsigned long long &iPos, unsigned long long iOffset, const void *data, size_t size)
+{
+	static const char zeros[FROZEN_FILE_ALIGN] = {0};
+	size_t iPad = (size_t)(iOffset - iPos);
+	if (iPad && fwrite(zeros, 1, iPad, f) != iPad)
+		return false;
+	if (size && fwrite(data, 1, size, f) != size)
+		return false;
+	iPos = iOffset + size;
+	return true;
+}
+
+
+bool CHMM_GMM_FrozenSet::SaveToFile(const char *szFileName, const vector<string> &names, const string &sSource) const
+{
+	if (!m_bBuilt || names.size() != m_nModels)
+		return false;
+
+	// dimensione dell'arena: fine dell'ultimo blocco
+	unsigned long long iArenaSize = 0;
+	size_t i;
+	for (i=0; i<m_nModels; i++)
+		iArenaSize = std::max(iArenaSize, m_pModels[i].iLogPi + m_pModels[i].iN);
+	for (i=0; i<m_nStates; i++)
+		iArenaSize = std::max(iArenaSize, m_pStates[i].iInvVar + (unsigned long long)m_pStates[i].iK*m_pStates[i].iM);
+
+	SFrozenFileHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.szMagic, FROZEN_FILE_MAGIC, 8);
+	header.iVersion = FROZEN_FILE_VERSION;
+	header.iEndian = FROZEN_FILE_ENDIAN;
+	header.iModelSize = sizeof(SModel);
+	header.iStateSize = sizeof(SState);
+	header.iDimension = m_iDimension;
+	header.iModels = m_nModels;
+	header.iStates = m_nStates;
+	header.iArenaSize = iArenaSize;
+	header.iModelsOffset = AlignFileOffset(sizeof(header));
+	header.iStatesOffset = AlignFileOffset(header.iModelsOffset + m_nModels*sizeof(SModel));
+	header.iArenaOffset = AlignFileOffset(header.iStatesOffset + m_nStates*sizeof(SState));
+	header.iNamesOffset = AlignFileOffset(header.iArenaOffset + iArenaSize*sizeof(double));
+
+	// tabella dei nomi: (posizione, lunghezza) rispetto all'inizio dei caratteri
+	vector<unsigned long long> nameTable(2*names.size());
+	string chars;
+	for (i=0; i<names.size(); i++){
+		nameTable[2*i] = chars.size();
+		nameTable[2*i+1] = names[i].size();
+		chars += names[i];
+	}
+	header.iSourceOffset = header.iNamesOffset + nameTable.size()*sizeof(unsigned long long) + chars.size();
+	header.iSourceSize = sSource.size();
+	header.iFileSize = header.iSourceOffset + sSource.size();
+
+	// scrivo accanto e poi rinomino: un altro processo non mappa mai un file a meta'
+	string sTemp = TempFileName(szFileName);
+	FILE *f = fopen(sTemp.c_str(), "wb");
+	if (!f)
+		return false;
+
+	unsigned long long iPos = 0;
+	bool bOk = WriteAt(f, iPos, 0, &header, sizeof(header)) &&
+		WriteAt(f, iPos, header.iModelsOffset, m_pModels, m_nModels*sizeof(SModel)) &&
+		WriteAt(f, iPos, header.iStatesOffset, m_pStates, m_nStates*sizeof(SState)) &&
+		WriteAt(f, iPos, header.iArenaOffset, m_pArena, (size_t)iArenaSize*sizeof(double)) &&
+		WriteAt(f, iPos, header.iNamesOffset, nameTable.empty() ? NULL : &nameTable[0], nameTable.size()*sizeof(unsigned long long)) &&
+		WriteAt(f, iPos, iPos, chars.data(), chars.size()) &&
+		WriteAt(f, iPos, header.iSourceOffset, sSource.data(), sSource.size());
+
+	if (fclose(f) != 0)
+		bOk = false;
+	if (!bOk){
+		remove(sTemp.c_str());
+		return false;
+	}
+	return ReplaceFileWith(szFileName, sTemp.c_str());
+}
+
+
+bool CHMM_GMM_FrozenSet::LoadMapped(const char *szFileName, vector<string> &names, string *pSource)
+{
+	Clear();
+	names.clear();
+	if (pSource)
+		pSource->clear();
+
+	std::shared_ptr<CMappedFile> mapped = std::make_shared<CMappedFile>();
+	if (!mapped->Open(szFileName) || mapped->Size() < sizeof(SFrozenFileHeader))
+		return false;
+
+	// controlli sull'intestazione: nessun dato viene convertito, quindi il layout deve essere identico
+	const char *data = mapped->Data();
+	const SFrozenFileHeader &header = *(const SFrozenFileHeader *)data;
+	if (memcmp(header.szMagic, FROZEN_FILE_MAGIC, 8) != 0 ||
+		header.iVersion != FROZEN_FILE_VERSION ||
+		header.iEndian != FROZEN_FILE_ENDIAN ||
+		header.iModelSize != sizeof(SModel) ||
+		header.iStateSize != sizeof(SState) ||
+		header.iFileSize != mapped->Size() ||
+		header.iModelsOffset + header.iModels*sizeof(SModel) > header.iStatesOffset ||
+		header.iStatesOffset + header.iStates*sizeof(SState) > header.iArenaOffset ||
+		header.iArenaOffset + header.iArenaSize*sizeof(double) > header.iNamesOffset ||
+		header.iNamesOffset + 2*header.iModels*sizeof(unsigned long long) > header.iSourceOffset ||
+		header.iSourceOffset + header.iSourceSize != header.iFileSize ||
+		header.iModelsOffset % FROZEN_FILE_ALIGN != 0 ||
+		header.iStatesOffset % FROZEN_FILE_ALIGN != 0 ||
+		header.iArenaOffset % FROZEN_FILE_ALIGN != 0)
+		return false;
+
+	// ogni posizione delle tabelle viene usata senza controlli durante il testing:
+	// un file corrotto o scritto per un altro vettore di feature non deve leggere fuori dall'arena
+	const SModel *pModels = (const SModel *)(data + header.iModelsOffset);
+	const SState *pStates = (const SState *)(data + header.iStatesOffset);
+	if (!CheckTables(pModels, (size_t)header.iModels, pStates, (size_t)header.iStates, header.iArenaSize, header.iDimension))
+		return false;
+
+	// nomi dei modelli
+	const unsigned long long *nameTable = (const unsigned long long *)(data + header.iNamesOffset);
+	const char *chars = (const char *)(nameTable + 2*header.iModels);
+	unsigned long long iCharsSize = header.iSourceOffset - (header.iNamesOffset + 2*header.iModels*sizeof(unsigned long long));
+	names.resize((size_t)header.iModels);
+	for (size_t i=0; i<names.size(); i++){
+		if (nameTable[2*i] + nameTable[2*i+1] > iCharsSize){
+			names.clear();
+			return false;
+		}
+		names[i].assign(chars + nameTable[2*i], (size_t)nameTable[2*i+1]);
+	}
+	if (pSource)
+		pSource->assign(data + header.iSourceOffset, (size_t)header.iSourceSize);
+
+	// tabelle e arena usate direttamente dalle pagine mappate
+	m_mapped = mapped;
+	m_pModels = pModels;
+	m_nModels = (size_t)header.iModels;
+	m_pStates = pStates;
+	m_nStates = (size_t)header.iStates;
+	m_pArena = (const double *)(data + header.iArenaOffset);
+	m_iDimension = header.iDimension;
+	m_bBuilt = true;
+	return true;
+}
+
+
+void CHMM_GMM_FrozenSet::ComputeLogEmissions(const double *observation, double *logB) const
+{
+	ComputeLogEmissions(observation, logB, 0, m_nModels);
+}
+
+
+void CHMM_GMM_FrozenSet::ComputeLogEmissions(const double *observation, double *logB, size_t iFirstModel, size_t iLastModel) const
+{
+	assert(m_bBuilt);
+	if (iFirstModel >= iLastModel)
+		return;
+	const double *base = Base();
+	vector<double> vdLL;
+	size_t sEnd = (iLastModel < m_nModels) ? (size_t)m_pModels[iLastModel].iFirstState : m_nStates;
+	for (size_t s=(size_t)m_pModels[iFirstModel].iFirstState; s<sEnd; s++){
+		const SState &st = m_pStates[s];
+		// shortcut for one subclass
+		if (st.iK==1){
+			logB[s] = base[st.iLogConst] - 0.5 * MahalanobisDiag(observation, base + st.iMeans, base + st.iInvVar, st.iM);
+			continue;
+		}
+		vdLL.resize(st.iK);
+		for (unsigned int k=0; k<st.iK; k++)
+			vdLL[k] = base[st.iLogConst + k] - 0.5 * MahalanobisDiag(observation, base + st.iMeans + k*st.iM, base + st.iInvVar + k*st.iM, st.iM);
+		LogSumExpColumns(vdLL.empty() ? NULL : &vdLL[0], st.iK, 1, 1, &logB[s]);
+	}
+}
+
+
+double CHMM_GMM_FrozenSet::ForwardStep(size_t iModel, CForwardState &state, const double *logB) const
+{
+	const SModel &mod = m_pModels[iModel];
+	return ForwardStepLog(state, mod.iN, Base() + mod.iPi, Base() + mod.iA, (int)mod.iN, logB);
+}
+
+
+} // namespace
@@ -0,0 +1,140 @@
+//------------------------------------------------------------------
+//
+// Nome file: hmm_frozen.h
+// Contenuto: insieme di CHMM_GMM "congelati" per il testing: tutti i
+//            parametri in un'unica area di memoria contigua e allineata
+//
+//------------------------------------------------------------------
+
+
+#pragma once
+
+#include <vector>
+#include <string>
+#include <memory>
+
+#include "gmmstd_hmm_GMM.h"
+
+
+namespace gmmstd{
+
+class CMappedFile;
+
+
+// Versione in sola lettura di un insieme di CHMM_GMM con covarianze diagonali.
+// I CHMM_GMM restano la rappresentazione modificabile (training, salvataggio);
+// qui i parametri vengono copiati una volta sola (Build) in un'unica arena di double,
+// modello dopo modello:
+//   A (N x N), log A (N x N), pi (N), log pi (N)
+//   per ogni stato: log(w_k)+costante (K), pesi (K), medie (K x M), inverso varianze (K x M)
+// Ogni blocco inizia su una linea di cache (64 byte), quindi il testing di un frame
+// scorre la memoria in modo lineare invece di saltare tra centinaia di piccoli Mat_.
+//
+// Le tabelle e l'arena possono anche essere salvate in un unico file binario (SaveToFile)
+// e poi mappate in memoria in sola lettura (LoadMapped): il file ha gia' il layout usato
+// per il testing, quindi il caricamento non legge ne' converte i parametri e piu' processi
+// sulla stessa macchina condividono le stesse pagine.
+class CHMM_GMM_FrozenSet
+{
+public:
+	CHMM_GMM_FrozenSet();
+
+	// copia i parametri dei modelli; false (set vuoto) se una gaussiana non e' diagonale
+	// o se gli stati non hanno tutti la stessa dimensione delle osservazioni
+	bool Build(vector<CHMM_GMM> &models);
+
+	// salva il set costruito con Build in un file binario, insieme a un nome per modello
+	// e a sSource, descrizione libera dei file da cui vengono i modelli (per capire se il
+	// file e' ancora aggiornato). Il file viene sostituito solo quando e' completo.
+	bool SaveToFile(const char *szFileName, const vector<string> &names, const string &sSource = string()) const;
+	// mappa in memoria un file scritto da SaveToFile; false (set vuoto) se il file non c'e'
+	// o non e' valido (versione, dimensioni, layout diversi, tabelle dei modelli o degli stati
+	// che escono dall'arena). In *pSource la sSource salvata.
+	bool LoadMapped(const char *szFileName, vector<string> &names, string *pSource = NULL);
+
+	// svuota il set (e rilascia il file mappato)
+	void Clear();
+
+	bool IsBuilt() const {
+		return m_bBuilt; }
+
+	size_t GetModelsNumber() const {
+		return m_nModels; }
+	unsigned int GetStatesNumber(size_t iModel) const {
+		return m_pModels[iModel].iN; }
+
+	// posizione in logB del primo stato del modello (come in HMMBank)
+	size_t GetEmissionOffset(size_t iModel) const {
+		return (size_t)m_pModels[iModel].iFirstState; }
+	size_t GetEmissionSize() const {
+		return m_nStates; }
+
+	// dimensione delle osservazioni (uguale per tutti gli stati), 0 se il set e' vuoto
+	unsigned int GetDimension() const {
+		return m_iDimension; }
+
+	// logB[s] = log b_s(observation) per tutti gli stati di tutti i modelli
+	// (observation deve avere GetDimension() elementi)
+	void ComputeLogEmissions(const double *observation, double *logB) const;
+	// come sopra ma solo per i modelli [iFirstModel, iLastModel): scrive logB nelle stesse
+	// posizioni della versione completa, quindi intervalli disgiunti si possono calcolare in parallelo
+	void ComputeLogEmissions(const double *observation, double *logB, size_t iFirstModel, size_t iLastModel) const;
+
+	// passo della forward incrementale sul modello iModel: stessi conti di CHMM_GMM::ForwardStep
+	double ForwardStep(size_t iModel, CForwardState &state, const double *logB) const;
+
+	// accesso ai blocchi del modello (righe contigue)
+	const double *GetA(size_t iModel) const {
+		return Base() + m_pModels[iModel].iA; }
+	const double *GetLogA(size_t iModel) const {
+		return Base() + m_pModels[iModel].iLogA; }
+	const double *GetPi(size_t iModel) const {
+		return Base() + m_pModels[iModel].iPi; }
+	const double *GetLogPi(size_t iModel) const {
+		return Base() + m_pModels[iModel].iLogPi; }
+
+private:
+	// le tabelle sono scritte cosi' come sono nel file: solo tipi a dimensione fissa
+	// posizioni (in double, rispetto a Base()) dei blocchi di un modello
+	struct SModel {
+		unsigned int iN, iM;
+		unsigned long long iA, iLogA, iPi, iLogPi;
+		unsigned long long iFirstState;
+	};
+	// posizioni dei blocchi di uno stato (una GMM)
+	struct SState {
+		unsigned int iK, iM;
+		unsigned long long iLogConst, iWeights, iMeans, iInvVar;
+	};
+
+	// i puntatori alle tabelle vanno rifatti ad ogni copia: non copiabile
+	CHMM_GMM_FrozenSet(const CHMM_GMM_FrozenSet &);
+	CHMM_GMM_FrozenSet &operator=(const CHMM_GMM_FrozenSet &);
+
+	// riserva n double allineati a 64 byte e ritorna la posizione
+	size_t Reserve(size_t &iSize, size_t n);
+
+	const double *Base() const {
+		return m_pArena; }
+
+	// controlla che le tabelle di un file mappato siano coerenti con l'arena
+	static bool CheckTables(const SModel *pModels, size_t nModels, const SState *pStates, size_t nStates,
+		unsigned long long iArenaSize, unsigned int iDimension);
+
+	bool m_bBuilt;
+	// tabelle e arena usate dal testing: puntano ai vettori qui sotto (Build) o al file mappato (LoadMapped)
+	const SModel *m_pModels;
+	size_t m_nModels;
+	const SState *m_pStates;
+	size_t m_nStates;
+	const double *m_pArena;
+	unsigned int m_iDimension;
+
+	vector<SModel> m_models;
+	vector<SState> m_states;
+	vector<double> m_arena; // un po' piu' grande del necessario per poter allineare l'inizio
+	std::shared_ptr<CMappedFile> m_mapped;
+};
+
+
+} // namespace
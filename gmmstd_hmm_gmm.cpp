@@ -17,6 +17,8 @@
 
 #define _CRT_SECURE_NO_DEPRECATE
 
+#include <sys/stat.h>
+
 #include "gmmstd_hmm_gmm.h"
 
 namespace gmmstd{
@@ -42,6 +44,9 @@ CHMM_GMM::CHMM_GMM(unsigned int N, unsigned  int M, unsigned int K)
 			m_dDurationMean=0;
 			m_dDurationVariance=0;
 
+			m_iTrainingThreads=0;
+			m_pTrainingPool=NULL;
+
 
 			// resize dei modelli B
 			unsigned int i;
@@ -57,6 +62,63 @@ CHMM_GMM::CHMM_GMM(unsigned int N, unsigned  int M, unsigned int K)
 
 
 		}   
+
+
+	CHMM_GMM::CHMM_GMM(const CHMM_GMM &ref){
+		*this = ref;
+	}
+
+	CHMM_GMM & CHMM_GMM::operator= (const CHMM_GMM &ref){
+		if (this == &ref)
+			return *this;
+		m_iN = ref.m_iN;
+		m_iM = ref.m_iM;
+		m_iK = ref.m_iK;
+		m_A = ref.m_A.clone();
+		m_B = ref.m_B;
+		m_pi = ref.m_pi.clone();
+		m_final = ref.m_final.clone();
+		m_bDiagonalCovariance = ref.m_bDiagonalCovariance;
+		m_bLeftRight = ref.m_bLeftRight;
+		m_dDurationMean = ref.m_dDurationMean;
+		m_dDurationVariance = ref.m_dDurationVariance;
+		m_dThreshold = ref.m_dThreshold;
+		m_bThreshold_normalized = ref.m_bThreshold_normalized;
+		m_bThreshold_alphat = ref.m_bThreshold_alphat;
+		m_bThreshold_length = ref.m_bThreshold_length;
+		m_iTrainingThreads = ref.m_iTrainingThreads;
+		m_pTrainingPool = ref.m_pTrainingPool;
+		return *this;
+	}
+
+	CHMM_GMM::CHMM_GMM(CHMM_GMM &&ref) GMMSTD_NOEXCEPT {
+		*this = std::move(ref);
+	}
+
+	CHMM_GMM & CHMM_GMM::operator= (CHMM_GMM &&ref) GMMSTD_NOEXCEPT {
+		if (this == &ref)
+			return *this;
+		m_iN = ref.m_iN;
+		m_iM = ref.m_iM;
+		m_iK = ref.m_iK;
+		MoveMat(m_A, ref.m_A);
+		m_B = std::move(ref.m_B);
+		MoveMat(m_pi, ref.m_pi);
+		MoveMat(m_final, ref.m_final);
+		m_bDiagonalCovariance = ref.m_bDiagonalCovariance;
+		m_bLeftRight = ref.m_bLeftRight;
+		m_dDurationMean = ref.m_dDurationMean;
+		m_dDurationVariance = ref.m_dDurationVariance;
+		m_dThreshold = ref.m_dThreshold;
+		m_bThreshold_normalized = ref.m_bThreshold_normalized;
+		m_bThreshold_alphat = ref.m_bThreshold_alphat;
+		m_bThreshold_length = ref.m_bThreshold_length;
+		m_iTrainingThreads = ref.m_iTrainingThreads;
+		m_pTrainingPool = ref.m_pTrainingPool;
+		ref.m_B.clear();
+		ref.m_iN = 0;
+		return *this;
+	}
 	
 
 
@@ -142,6 +204,107 @@ CHMM_GMM::CHMM_GMM(unsigned int N, unsigned  int M, unsigned int K)
 
 
 
+	// inizializzazione per il training: pi e A fissi, gaussiane casuali intorno alle osservazioni
+	bool CHMM_GMM::Init_Random_Moments(vector<double> &means, vector<double> &Sqrtvariance, double T, int E, double SumOfSquareT)
+	{
+		// probabilit iniziali
+		int i;
+
+		if (!E || !T)
+			return false;
+
+		if (m_bLeftRight){
+			// prob iniziale
+			fill(m_pi.begin(),m_pi.end(), 0);
+			m_pi(0,0)=1.0;
+			//matrice A: 
+			fill(m_A.begin(),m_A.end(),0.); 
+			for (i=0; i<m_iN-1; i++){
+				m_A(i,i)=0.5;
+				m_A(i,i+1)=0.5;
+			}
+			m_A(m_iN-1,m_iN-1)=1;
+		}
+
+		else
+		{   // prob iniz
+			fill(m_pi.begin(),m_pi.end(), 1.0/m_iN);
+			//matrice A: 0.6 sulla diagonale, 0.4/(numstates-1) dalle altre parti
+			fill(m_A.begin(),m_A.end(), 0.4/(m_iN-1));
+			for (i=0; i<m_iN; i++)
+				m_A(i,i)=0.6;
+
+		}
+
+		
+		// calcolo varianze e medie vere
+		for (i=0; i<m_iM; i++)
+			{
+				means[i]/=T; // T*E;
+				Sqrtvariance[i]=3.0*sqrt((Sqrtvariance[i]/T)- (means[i]*means[i]));
+			}
+
+
+		int n,m,k;
+		// ora imposto le gaussiane a normali
+		for (n=0; n<m_iN; n++)
+			for (k=0; k<m_iK; k++)
+				m_B[n].GetGaussian(k).SetToNormal();
+			
+
+		for (n=0; n<m_iN; n++)
+			for (k=0; k<m_iK; k++)
+			{
+				for (m=0; m<m_iM; m++)
+				{
+					// setto valore medio delle gaussiane
+					m_B[n].MeanValue(k,m) = random_Uniform(means[m]-3.0*Sqrtvariance[m],means[m]+3.0*Sqrtvariance[m]);
+					// setto varianza delle gaussiane
+					m_B[n].CoVarianceValue(k,m,m)=(Sqrtvariance[m])*(Sqrtvariance[m]);
+				}
+				// peso uniforme
+				m_B[n].WeightValue(k)=1.0 / m_iK;
+			}
+
+
+		// media e varianza delle lunghezze
+		m_dDurationMean =  T / E;
+		m_dDurationVariance = (SumOfSquareT / E) - (m_dDurationMean *m_dDurationMean);
+
+
+		return true;
+	}
+
+
+	bool CHMM_GMM::Init_Random_Stream(CSequenceReader &reader)
+	{
+		vector<double> means (m_iM,0.);
+		vector<double> Sqrtvariance (m_iM,0.);
+		double T=0; // total duration
+		int E=0; // number of sequences
+		double SumOfSquareT=0;
+
+		if (!reader.Rewind())
+			return false;
+
+		// una sola sequenza alla volta in memoria
+		vector<vector<double> > seq;
+		while (reader.Next(seq))
+		{
+			int len;
+			means = std::accumulate(seq.begin(), seq.end(), means, vecsum<vector<double>>());
+			Sqrtvariance = std::accumulate(seq.begin(), seq.end(), Sqrtvariance, vecsumquad<vector<double>>());
+			len = (int)seq.size();
+			T += len;
+			SumOfSquareT += len*len;
+			E++;
+		}
+
+		return Init_Random_Moments(means, Sqrtvariance, T, E, SumOfSquareT);
+	}
+
+
+
 
 
 	// leggo e scrivo su file
@@ -196,7 +359,8 @@ CHMM_GMM::CHMM_GMM(unsigned int N, unsigned  int M, unsigned int K)
 			fread(&(m_bThreshold_alphat),sizeof(bool),1,f);
 			fread(&(m_bThreshold_length),sizeof(bool),1,f);
 
-			return true;
+			// file troncato o errore di lettura
+			return !ferror(f) && !feof(f);
 	}
 
 
@@ -252,6 +416,14 @@ CHMM_GMM::CHMM_GMM(unsigned int N, unsigned  int M, unsigned int K)
 		bool ris;
                 f = fopen(strFileName,"rb");
 		if (!f) return false;
+		// buffer grande quanto tutto il file: una sola lettura invece di una ogni
+		// BUFSIZ byte (il buffer deve restare vivo fino a fclose)
+		vector<char> buffer;
+		struct stat info;
+		if (stat(strFileName,&info) == 0 && info.st_size > 0) {
+			buffer.resize((size_t)info.st_size + 1);
+			setvbuf(f,&buffer[0],_IOFBF,buffer.size());
+		}
 		ris = LoadFromFile(f);
 		// chiudo il file
 		fclose(f);
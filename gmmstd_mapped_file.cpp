@@ -0,0 +1,109 @@
+//------------------------------------------------------------------
+//
+// Nome file: mapped_file.cpp
+// Contenuto: file mappato in memoria in sola lettura
+//
+//------------------------------------------------------------------
+
+
+#include "gmmstd_mapped_file.h"
+
+#include <stdio.h>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace gmmstd{
+
+
+CMappedFile::CMappedFile():
+	m_pData(NULL), m_iSize(0)
+#ifdef _WIN32
+	, m_hFile(INVALID_HANDLE_VALUE), m_hMapping(NULL)
+#endif
+{
+}
+
+
+CMappedFile::~CMappedFile()
+{
+#ifdef _WIN32
+	if (m_pData)
+		UnmapViewOfFile(m_pData);
+	if (m_hMapping)
+		CloseHandle(m_hMapping);
+	if (m_hFile != INVALID_HANDLE_VALUE)
+		CloseHandle(m_hFile);
+#else
+	if (m_pData)
+		munmap((void *)m_pData, m_iSize);
+#endif
+}
+
+
+bool CMappedFile::Open(const char *szFileName)
+{
+#ifdef _WIN32
+	// FILE_SHARE_DELETE: un altro processo puo' sostituire il file (ReplaceFileWith) mentre e' mappato
+	m_hFile = CreateFileA(szFileName, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (m_hFile == INVALID_HANDLE_VALUE)
+		return false;
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(m_hFile, &size) || size.QuadPart == 0)
+		return false;
+	m_iSize = (size_t)size.QuadPart;
+	m_hMapping = CreateFileMappingA(m_hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (!m_hMapping)
+		return false;
+	m_pData = (const char *)MapViewOfFile(m_hMapping, FILE_MAP_READ, 0, 0, 0);
+#else
+	int fd = open(szFileName, O_RDONLY);
+	if (fd < 0)
+		return false;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0){
+		close(fd);
+		return false;
+	}
+	m_iSize = (size_t)st.st_size;
+	void *p = mmap(NULL, m_iSize, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	m_pData = (p == MAP_FAILED) ? NULL : (const char *)p;
+#endif
+	return m_pData != NULL;
+}
+
+
+std::string TempFileName(const char *szFileName)
+{
+	char szSuffix[32];
+#ifdef _WIN32
+	sprintf(szSuffix, ".%lu.tmp", (unsigned long)GetCurrentProcessId());
+#else
+	sprintf(szSuffix, ".%lu.tmp", (unsigned long)getpid());
+#endif
+	return std::string(szFileName) + szSuffix;
+}
+
+
+bool ReplaceFileWith(const char *szFileName, const char *szTempName)
+{
+#ifdef _WIN32
+	bool bOk = MoveFileExA(szTempName, szFileName, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+	bool bOk = rename(szTempName, szFileName) == 0;
+#endif
+	if (!bOk)
+		remove(szTempName);
+	return bOk;
+}
+
+
+} // namespace
@@ -0,0 +1,58 @@
+//------------------------------------------------------------------
+//
+// Nome file: mapped_file.h
+// Contenuto: file mappato in memoria in sola lettura
+//
+//------------------------------------------------------------------
+
+
+#pragma once
+
+#include <stddef.h>
+#include <string>
+
+
+namespace gmmstd{
+
+
+// File mappato in memoria in sola lettura (le pagine sono condivise tra i processi).
+// Usato dai file binari che vengono letti direttamente nel loro formato su disco
+// (banca dei modelli, feature di training).
+class CMappedFile
+{
+public:
+	CMappedFile();
+	~CMappedFile();
+
+	// false se il file non c'e', e' vuoto o non si riesce a mappare
+	bool Open(const char *szFileName);
+
+	const char *Data() const {
+		return m_pData; }
+	size_t Size() const {
+		return m_iSize; }
+
+private:
+	CMappedFile(const CMappedFile &);
+	CMappedFile &operator=(const CMappedFile &);
+
+	const char *m_pData;
+	size_t m_iSize;
+#ifdef _WIN32
+	void *m_hFile;		// HANDLE
+	void *m_hMapping;	// HANDLE
+#endif
+};
+
+
+// Nome di un file temporaneo accanto a szFileName, diverso per ogni processo
+// (nella stessa cartella, cosi' ReplaceFileWith e' una semplice rinomina)
+std::string TempFileName(const char *szFileName);
+
+// Mette szTempName al posto di szFileName con una rinomina: chi apre (o mappa) szFileName
+// trova il file vecchio o quello nuovo completo, mai uno scritto a meta'.
+// Se non riesce szTempName viene cancellato e szFileName resta com'era.
+bool ReplaceFileWith(const char *szFileName, const char *szTempName);
+
+
+} // namespace
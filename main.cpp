@@ -17,6 +17,7 @@
 #include <fstream>
 // FrameAnalyzer
 #include "FrameAnalyzer.h"
+#include "DatasetRunner.h"
 #include "config.h"
 
 using namespace cv;
@@ -24,7 +25,7 @@ using namespace std;
 
 // Dichiarazione delle funzioni
 void help();
-void videoProcessing(char* filename, string category);
+void videoProcessing(char* filename, string category, bool headlessRun);
 vector<string> parseDatasetFile(string datasetFileName);
 
 // ------------------ MAIN -------------------------------
@@ -34,27 +35,34 @@ int main(int argc, char* argv[])
 	help();
 
 	//check for the input parameter correctness
-	if(argc != 3) {
+	if(argc != 3 && argc != 4) {
 		cerr <<"Incorret input list" << endl;
 		cerr <<"exiting..." << endl;
 		system("pause");
 		return EXIT_FAILURE;
 	}
 
+	// senza display: niente finestre e il ciclo dei frame non aspetta waitKey
+	bool headlessRun = headless || (argc == 4 && strcmp(argv[3], "-headless") == 0);
 
 	if(processALL) {
+		// tutti i video del dataset in parallelo (sempre senza finestre), con un solo report finale
 		vector<string> datasetLines = parseDatasetFile("dataset.txt");
-		for(size_t i=0; i<datasetLines.size(); ++i)
-		{
-			string category = datasetLines[i].substr(0, datasetLines[i].find("|"));
-			string filePath = datasetLines[i].substr((datasetLines[i].find("|")+1), datasetLines[i].length());
-			videoProcessing(&filePath[0u], category);
-		}
+		double t = (double)getTickCount();
+		DatasetRunner runner(datasetThreads);
+		vector<VideoReport> reports = runner.run(datasetLines);
+		t = (double)getTickCount() - t;
+
+		DatasetRunner::printReport(reports, cout);
+		cout << "Tempo reale (s): " << t/getTickFrequency() << endl;
+		ofstream reportFile("dataset_report.txt");
+		DatasetRunner::printReport(reports, reportFile);
+		reportFile << "Tempo reale (s): " << t/getTickFrequency() << endl;
 	}
 	else{
 		if(strcmp(argv[1], "-vid") == 0) {
 			// inizia il processing del video
-			videoProcessing(argv[2], "NULL");
+			videoProcessing(argv[2], "NULL", headlessRun);
 
 		}
 		else {
@@ -67,17 +75,24 @@ int main(int argc, char* argv[])
 	}
 
 	//destroy GUI windows
-	destroyAllWindows();
-	system("pause");
+	if(!headlessRun){
+		destroyAllWindows();
+		system("pause");
+	}
 	return EXIT_SUCCESS;
 }
 
-void videoProcessing(char* filename, string category){
+void videoProcessing(char* filename, string category, bool headlessRun){
 
 	float fps = 0;
 
 	// inizializzo l'oggetto che analizzer il video
-	FrameAnalyzer frameAnalyzer(filename, category);
+	FrameAnalyzer frameAnalyzer(filename, category, 0, headlessRun);
+	if(!frameAnalyzer.isOpened()){
+		// l'errore e' gia' stato stampato dal costruttore
+		system("pause");
+		exit(EXIT_FAILURE);
+	}
 
 	// stampo info sul video
 	cout << "Analisi Video:" << endl;
@@ -90,10 +105,13 @@ void videoProcessing(char* filename, string category){
 
 		// quando arriva alla fine esco comunque dal while
 		if(!frameAnalyzer.processFrame()) break;
-		waitKey(waitTimeSpan);
+		if(!headlessRun)
+			waitKey(waitTimeSpan);
 	}
 	t = (double)getTickCount() - t; 
 	fps += t*1000./cv::getTickFrequency();
+	// fermo i thread della pipeline: da qui i tempi medi non cambiano piu'
+	frameAnalyzer.stop();
 
 	//Tempi utili per prestazioni (attuali: BS=10.7, PD=36.3, FPS=12.7)
 	cout << "Tempo medio per la Background Subtraction: " << frameAnalyzer.avgBsTime/frameAnalyzer.getFrameCount() << endl;
@@ -124,7 +142,7 @@ void help()
 	cout
 		<< "--------------------------------------------------------------------------"  << endl
 		<< "Usage:"                                                                      << endl
-		<< "./bs {-vid <video filename>|-img <image filename>}"                          << endl
+		<< "./bs {-vid <video filename>|-img <image filename>} [-headless]"              << endl
 		<< "for example: ./bs -vid video.avi"                                            << endl
 		<< "or: ./bs -img /data/images/1.png"                                            << endl
 		<< "--------------------------------------------------------------------------"  << endl
@@ -12,6 +12,12 @@
 
 #include <windows.h>
 
+// SSE2 (sempre presente su x64) per le proiezioni della silhouette
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#include <emmintrin.h>
+#define UTILS_SSE2
+#endif
+
 
 
 /*---------------------------------------------------------------------------------------------------------------------
@@ -38,19 +44,45 @@ cv::Mat1b drawHist(const std::vector<double> &hist, cv::Size imgSize) {
 
 
 /*---------------------------------------------------------------------------------------------------------------------
-La funzione quantize trasforma un istogramma da un numero di bin pari a old_dim
-ad un numero di bin pari a new_dim. Non sono sicuro al 100% che sia priva di bug. 
+La funzione resampleHistogram porta un istogramma di n valori (es: i conteggi di projectSilhouette) a new_dim bin
+e lo normalizza in modo che la somma dei bin sia 1, in una sola passata.
+Il bin di uscita b copre l'intervallo [b*n/new_dim, (b+1)*n/new_dim) dell'istogramma di partenza: ogni valore
+contribuisce ai bin che tocca in proporzione alla sovrapposizione, quindi non si perde nessun valore anche
+quando n non  multiplo di new_dim (la vecchia quantize scartava il resto) e funziona anche con n < new_dim.
+I conti sono fatti in unit di 1/(n*new_dim), cos i confini dei bin sono interi esatti.
+out deve avere spazio per new_dim valori. Se l'istogramma  tutto a zero restano tutti zero.
 ---------------------------------------------------------------------------------------------------------------------*/
-void quantize(std::vector<double> &hist, double old_dim, double new_dim) {
-	int scalef = floor(old_dim / new_dim);
-
-	int k=1;
-	for(int i=0;i<new_dim;++i) {
-		for(int j=0;j<scalef-1;++j) {
-			hist[i] += hist[k++]; 
+void resampleHistogram(const int *hist, int n, int new_dim, double *out) {
+
+	std::fill(out, out + new_dim, 0.0);
+	if(n <= 0 || new_dim <= 0)
+		return;
+
+	double total = 0;
+	int b = 0;
+	long long binEnd = n; // fine del bin b
+	for(int i=0;i<n;++i) {
+		double val = hist[i];
+		total += val;
+		long long lo = (long long)i * new_dim;
+		long long hi = lo + new_dim;
+		while(lo < hi) {
+			long long end = std::min(hi, binEnd);
+			out[b] += val * (double)(end - lo);
+			lo = end;
+			if(end == binEnd && b+1 < new_dim) {
+				++b;
+				binEnd += n;
+			}
 		}
 	}
-	hist.resize(new_dim);
+
+	// ogni valore ha contribuito con peso totale new_dim
+	if(total != 0) {
+		double norm = 1.0 / (total * new_dim);
+		for(int k=0;k<new_dim;++k)
+			out[k] *= norm;
+	}
 }
 
 
@@ -65,6 +97,75 @@ void sumToOne (std::vector<double>& histo) {
 }
 
 
+/*---------------------------------------------------------------------------------------------------------------------
+La funzione projectSilhouette conta i pixel diversi da zero di ogni riga e di ogni colonna di una maschera,
+con una sola lettura dell'immagine (prima erano rows+cols chiamate a countNonZero, quelle sulle colonne
+a salti di una riga intera). Con SSE2 si confrontano 16 byte alla volta: la somma dei byte d il conteggio
+della riga, gli stessi byte espansi a 16 bit si sommano ai contatori delle colonne.
+rowCounts e colCounts vengono ridimensionati a frame.rows e frame.cols.
+---------------------------------------------------------------------------------------------------------------------*/
+void projectSilhouette (const cv::Mat &frame, std::vector<int> &rowCounts, std::vector<int> &colCounts) {
+
+	rowCounts.assign(frame.rows, 0);
+	colCounts.assign(frame.cols, 0);
+
+	// maschere non a 8 bit: versione con countNonZero
+	if(frame.type() != CV_8UC1) {
+		for (int i = 0; i<frame.rows; ++i)
+			rowCounts[i] = countNonZero(frame.row(i));
+		for (int i = 0; i<frame.cols; ++i)
+			colCounts[i] = countNonZero(frame.col(i));
+		return;
+	}
+
+	const int cols = frame.cols;
+
+#ifdef UTILS_SSE2
+	// contatori delle colonne a 16 bit, riversati in colCounts prima che possano traboccare
+	const int simdCols = cols & ~15;
+	std::vector<unsigned short> colAcc(simdCols, 0);
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i one = _mm_set1_epi8(1);
+	int pendingRows = 0;
+#endif
+
+	for (int r = 0; r<frame.rows; ++r) {
+		const uchar *row = frame.ptr<uchar>(r);
+		int count = 0;
+		int c = 0;
+#ifdef UTILS_SSE2
+		__m128i rowAcc = zero;
+		for (; c<simdCols; c+=16) {
+			__m128i v = _mm_loadu_si128((const __m128i*)(row + c));
+			__m128i nz = _mm_andnot_si128(_mm_cmpeq_epi8(v, zero), one); // 1 dove il pixel e' diverso da 0
+			rowAcc = _mm_add_epi64(rowAcc, _mm_sad_epu8(nz, zero));
+			__m128i *acc = (__m128i*)&colAcc[c];
+			_mm_storeu_si128(acc,     _mm_add_epi16(_mm_loadu_si128(acc),     _mm_unpacklo_epi8(nz, zero)));
+			_mm_storeu_si128(acc + 1, _mm_add_epi16(_mm_loadu_si128(acc + 1), _mm_unpackhi_epi8(nz, zero)));
+		}
+		count = _mm_cvtsi128_si32(rowAcc) + _mm_cvtsi128_si32(_mm_srli_si128(rowAcc, 8));
+		if(++pendingRows == 65535) {
+			for (int k = 0; k<simdCols; ++k)
+				colCounts[k] += colAcc[k];
+			std::fill(colAcc.begin(), colAcc.end(), 0);
+			pendingRows = 0;
+		}
+#endif
+		for (; c<cols; ++c) {
+			int nz = (row[c] != 0);
+			count += nz;
+			colCounts[c] += nz;
+		}
+		rowCounts[r] = count;
+	}
+
+#ifdef UTILS_SSE2
+	for (int k = 0; k<simdCols; ++k)
+		colCounts[k] += colAcc[k];
+#endif
+}
+
+
 /*---------------------------------------------------------------------------------------------------------------------
 La funzione roundToTen arrotonda un numero alla decina successiva o precedente a seconda che l'unit sia maggiore
 o meno di cinque. Esempi: 143-> 140, 79->80 ecc.
@@ -102,30 +203,18 @@ void computeFeatureVector ( cv::Mat &frame, int bins, std::vector<double> &featu
 							   //	Per calcolare THETA mi muovo invece da peopleRect.x a (peopleRect.x+peopleRect.width)
 							   //	scorrendo la silhouette per fette verticali.
 
-							   int hist_pi_size = frame.rows; //prima era 480
-							   int hist_theta_size = frame.cols; //prima era 640
-							   std::vector<double> hist_pi		= std::vector<double>(hist_pi_size);
-							   std::vector<double> hist_theta	= std::vector<double>(hist_theta_size);
-
-							   for (int i = 0; i<hist_pi_size; ++i)
-								   hist_pi[i] = countNonZero(frame.row(i));
+							   std::vector<int> hist_pi;		// frame.rows conteggi, prima erano 480
+							   std::vector<int> hist_theta;	// frame.cols conteggi, prima erano 640
 
-							   for (int i = 0; i<hist_theta_size; ++i) 
-								   hist_theta[i] = countNonZero(frame.col(i));
+							   // conteggi per righe (pi) e per colonne (theta) in una sola passata
+							   projectSilhouette(frame, hist_pi, hist_theta);
 
 
-							   // Normalizzazione dei due istogrammi in modo che la somma dei valori sia = 1
-							   sumToOne(hist_pi);
-							   sumToOne(hist_theta);
-
-							   // Quantizzazione dei due istogrammi per ridurre il numero di bin a K/2
-							   quantize(hist_pi,	 hist_pi.size(),	bins/2);
-							   quantize(hist_theta, hist_theta.size(), bins/2);
-
-
-							   // Crea il feature vector ( passato per reference) concatenando i due istogrammi 'pi' e 'theta'
-							   featureVector = hist_pi;	
-							   featureVector.insert( featureVector.end(), hist_theta.begin(), hist_theta.end() );
+							   // Crea il feature vector ( passato per reference) concatenando i due istogrammi 'pi' e 'theta',
+							   // ognuno ridotto a K/2 bin e normalizzato in modo che la somma dei valori sia = 1
+							   featureVector.assign(2*(bins/2), 0.0);
+							   resampleHistogram(hist_pi.empty() ? NULL : &hist_pi[0],			(int)hist_pi.size(),	bins/2, &featureVector[0]);
+							   resampleHistogram(hist_theta.empty() ? NULL : &hist_theta[0],	(int)hist_theta.size(), bins/2, &featureVector[bins/2]);
 
 							   if(createHistImages)
 							   {
@@ -135,7 +224,8 @@ void computeFeatureVector ( cv::Mat &frame, int bins, std::vector<double> &featu
 								   int imgWidth = 640;
 
 								   // Crea l'immagine di hist_pi
-								   histogramImages[0] = cv::Mat1b(imgHeight, imgWidth, uchar(0));
+								   histogramImages[0].create(imgHeight, imgWidth, CV_8UC1); // riusa il buffer se c'e' gia'
+								   histogramImages[0].setTo(cv::Scalar(0));
 								   for(size_t i=0; i<featureVector.size()/2; ++i)	{
 									   int binH = imgHeight * featureVector[i];
 									   cv::Point p1(	i	*	binW,	imgHeight		);
@@ -144,7 +234,8 @@ void computeFeatureVector ( cv::Mat &frame, int bins, std::vector<double> &featu
 								   }
 
 								   // Crea l'immagine di hist_theta
-								   histogramImages[1] = cv::Mat1b(imgHeight, imgWidth, uchar(0));
+								   histogramImages[1].create(imgHeight, imgWidth, CV_8UC1); // riusa il buffer se c'e' gia'
+								   histogramImages[1].setTo(cv::Scalar(0));
 								   for(size_t i=featureVector.size()/2; i<featureVector.size(); ++i)	{
 									   int binH = imgHeight * featureVector[i];
 									   cv::Point p1(	(i	-	featureVector.size()/2)	*	binW,	imgHeight		);
@@ -155,18 +246,6 @@ void computeFeatureVector ( cv::Mat &frame, int bins, std::vector<double> &featu
 
 }
 
-void writeFeatureVectorToFile (std::string category, std::string outFileName, std::vector<double> featureVector)
-{
-	// Memento: se la directory  gi esistente, CreateDirectory fallisce silenziosamente
-	bool flag = CreateDirectory("training", NULL);
-	std::string folder = "training\\" + category;
-	std::string outPath = folder + "\\" + outFileName;
-	flag = CreateDirectory(folder.c_str(), NULL);
-	std::ofstream out(outPath, std::ios::out | std::ios::app);
-	std::for_each(featureVector.begin(), featureVector.end(), [&out] (double val) {out << val << std::endl;});
-	out.close();
-}
-
 void fillGroundTruth(std::vector<std::string>& performance, char* filename, std::string groundTruth){
 
 	// Get person Name